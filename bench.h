@@ -0,0 +1,28 @@
+#ifndef _bench_h
+#define _bench_h
+
+#include <stdio.h>
+#include <comp421/hardware.h>
+#include <comp421/yalnix.h>
+
+/*
+ * Result reporting shared by the bench_* programs.
+ *
+ * Each result is written to terminal 0 as the CSV line
+ * "bench,program,case,count,ticks", where count is the number of
+ * operations timed. make -C hostsim bench runs each program and
+ * collects these lines from TTYLOG.0 into bench.csv.
+ */
+
+static void
+bench_report(char *program, char *name, int count, int ticks)
+{
+    char line[TERMINAL_MAX_LINE];
+    int len;
+
+    len = sprintf(line, "bench,%s,%s,%d,%d\n", program, name, count, ticks);
+    TtyWrite(0, line, len);
+    TracePrintf(0, "%s: %s: %d in %d ticks\n", program, name, count, ticks);
+}
+
+#endif
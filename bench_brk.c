@@ -0,0 +1,46 @@
+#include <stdlib.h>
+#include "bench.h"
+
+/*
+ * Brk grow/shrink loop.
+ *
+ * Moves the break up by GROW_PAGES, touches each new page, and moves
+ * it back down again, ROUNDS times. The count is the number of pages
+ * allocated and freed.
+ */
+
+#define ROUNDS          100
+#define GROW_PAGES      16
+
+int
+main()
+{
+    char *base;
+    int i, j, start;
+
+    // Start on a page boundary above anything malloc has handed out
+    if ((base = malloc(1)) == NULL)
+        Exit(ERROR);
+    base = (char *)UP_TO_PAGE(base + PAGESIZE);
+    if (Brk(base) == ERROR)
+        Exit(ERROR);
+
+    start = GetTicks();
+    for (i = 0; i < ROUNDS; ++i) {
+        if (Brk(base + GROW_PAGES * PAGESIZE) == ERROR) {
+            TracePrintf(0, "bench_brk: Brk failed growing\n");
+            Exit(ERROR);
+        }
+        for (j = 0; j < GROW_PAGES; ++j)
+            base[j * PAGESIZE] = j;
+        if (Brk(base) == ERROR) {
+            TracePrintf(0, "bench_brk: Brk failed shrinking\n");
+            Exit(ERROR);
+        }
+    }
+
+    bench_report("bench_brk", "grow_shrink", ROUNDS * GROW_PAGES,
+        GetTicks() - start);
+
+    Exit(0);
+}
@@ -0,0 +1,37 @@
+#include "bench.h"
+
+/*
+ * Delay timer storm.
+ *
+ * CHILDREN processes each Delay(1) DELAYS times, so every clock tick
+ * wakes all of them at once. With no overhead the storm would take
+ * DELAYS ticks; the count is the total number of Delay calls.
+ */
+
+#define CHILDREN        32
+#define DELAYS          50
+
+int
+main()
+{
+    int i, status, start;
+
+    start = GetTicks();
+    for (i = 0; i < CHILDREN; ++i) {
+        if (Fork() == 0) {
+            int j;
+
+            for (j = 0; j < DELAYS; ++j)
+                Delay(1);
+            Exit(0);
+        }
+    }
+
+    for (i = 0; i < CHILDREN; ++i)
+        Wait(&status);
+
+    bench_report("bench_delay", "delay_storm", CHILDREN * DELAYS,
+        GetTicks() - start);
+
+    Exit(0);
+}
@@ -0,0 +1,46 @@
+#include <stdlib.h>
+#include "bench.h"
+
+/*
+ * Fork/exit storm.
+ *
+ * Forks FORKS children one at a time, each of which exits at once,
+ * so the time is dominated by Fork, Exit and Wait. Then forks
+ * FORKS children from a parent with HEAP_PAGES of touched heap, to
+ * see how the cost grows with the size of the address space.
+ */
+
+#define FORKS           200
+#define HEAP_PAGES      64
+
+static int
+storm(void)
+{
+    int i, status, start = GetTicks();
+
+    for (i = 0; i < FORKS; ++i) {
+        if (Fork() == 0)
+            Exit(0);
+        Wait(&status);
+    }
+
+    return GetTicks() - start;
+}
+
+int
+main()
+{
+    char *heap;
+    int i;
+
+    bench_report("bench_fork", "fork_exit", FORKS, storm());
+
+    if ((heap = malloc(HEAP_PAGES * PAGESIZE)) == NULL)
+        Exit(ERROR);
+    for (i = 0; i < HEAP_PAGES; ++i)
+        heap[i * PAGESIZE] = 1;
+
+    bench_report("bench_fork", "fork_exit_heap", FORKS, storm());
+
+    Exit(0);
+}
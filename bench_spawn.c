@@ -0,0 +1,94 @@
+#include <string.h>
+#include "bench.h"
+
+/*
+ * Fork+exec spawn latency.
+ *
+ * Starts children in ROUNDS bursts of BURST, each running this
+ * program again with a "child" argument, which exits straight away,
+ * and times each burst from the first launch until the last child has
+ * been reaped. The children are started first with Fork and Exec,
+ * then with Spawn, then with PoolSpawn.
+ *
+ * Each burst is preceded by an untimed Delay, which leaves the CPU
+ * idle so that the kernel can refill the PoolSpawn pool; BURST is the
+ * pool size, so every pooled child is handed out pre-loaded. A burst
+ * is well under a tick, so the benchmark is run with short ticks.
+ */
+
+#define ROUNDS          50
+#define BURST           2       // POOL_SIZE in kernel.h
+#define IDLE_TICKS      3
+
+#define FORK_EXEC       0
+#define SPAWN           1
+#define POOL_SPAWN      2
+
+static char *args[] = { "bench_spawn", "child", NULL };
+
+static int
+launch(int how)
+{
+    int pid;
+
+    if (how == SPAWN)
+        return Spawn(args[0], args);
+    if (how == POOL_SPAWN)
+        return PoolSpawn(args[0], args);
+
+    if ((pid = Fork()) == 0) {
+        Exec(args[0], args);
+        Exit(ERROR);
+    }
+
+    return pid;
+}
+
+static int
+bursts(int how)
+{
+    int i, n, status, start, ticks = 0;
+
+    for (i = 0; i < ROUNDS; ++i) {
+        Delay(IDLE_TICKS);
+
+        start = GetTicks();
+        for (n = 0; n < BURST; ++n) {
+            if (launch(how) == ERROR) {
+                TracePrintf(0, "bench_spawn: launch failed\n");
+                Exit(ERROR);
+            }
+        }
+
+        for (n = 0; n < BURST; ++n) {
+            Wait(&status);
+            if (status != 0) {
+                TracePrintf(0, "bench_spawn: child failed\n");
+                Exit(ERROR);
+            }
+        }
+        ticks += GetTicks() - start;
+    }
+
+    return ticks;
+}
+
+int
+main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "child") == 0)
+        Exit(0);
+
+    bench_report("bench_spawn", "fork_exec", ROUNDS * BURST,
+        bursts(FORK_EXEC));
+    bench_report("bench_spawn", "spawn", ROUNDS * BURST, bursts(SPAWN));
+    bench_report("bench_spawn", "pool_spawn", ROUNDS * BURST,
+        bursts(POOL_SPAWN));
+
+    if (Spawn("no_such_program", NULL) != ERROR) {
+        TracePrintf(0, "bench_spawn: Spawn accepted a missing program\n");
+        Exit(ERROR);
+    }
+
+    Exit(0);
+}
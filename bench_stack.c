@@ -0,0 +1,53 @@
+#include "bench.h"
+
+/*
+ * Deep recursion stack growth.
+ *
+ * Each of CHILDREN fresh children recurses DEPTH calls deep with a
+ * FRAME_BYTES local array in each frame, so the stack grows a page at
+ * a time through the memory fault handler. The count is the number of
+ * stack pages faulted in. Repeating the recursion in the parent once
+ * its own stack has grown shows the cost of the calls alone.
+ */
+
+#define CHILDREN        16
+#define DEPTH           200
+#define FRAME_BYTES     512
+
+static int
+recurse(int depth)
+{
+    volatile char frame[FRAME_BYTES];
+
+    frame[0] = depth;
+    frame[FRAME_BYTES - 1] = depth;
+    if (depth == 0)
+        return frame[0];
+
+    return recurse(depth - 1) + frame[FRAME_BYTES - 1];
+}
+
+int
+main()
+{
+    int i, status, start, pages = DEPTH * FRAME_BYTES / PAGESIZE;
+
+    start = GetTicks();
+    for (i = 0; i < CHILDREN; ++i) {
+        if (Fork() == 0) {
+            recurse(DEPTH);
+            Exit(0);
+        }
+        Wait(&status);
+    }
+    bench_report("bench_stack", "grow", CHILDREN * pages, GetTicks() - start);
+
+    recurse(DEPTH);
+    start = GetTicks();
+    for (i = 0; i < CHILDREN; ++i)
+        recurse(DEPTH);
+    bench_report("bench_stack", "warm", CHILDREN * pages,
+        GetTicks() - start);
+
+    Exit(0);
+}
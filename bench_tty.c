@@ -0,0 +1,59 @@
+#include <stdlib.h>
+#include <string.h>
+#include "bench.h"
+
+/*
+ * TTY bulk write and echo.
+ *
+ * Writes BULK_LINES full lines of LINE_BYTES to terminal 1, then
+ * writes the same amount as BULK_CALLS single large TtyWrites. The
+ * count for both is the number of bytes written.
+ *
+ * If given a count as its argument, it then reads that many lines
+ * from terminal 2 and writes each one straight back, for an echo
+ * rate in lines. The lines have to be typed, or scripted with hostsim
+ * -i, so the echo is skipped by default.
+ */
+
+#define LINE_BYTES      80
+#define BULK_LINES      200
+#define BULK_CALLS      4
+
+int
+main(int argc, char **argv)
+{
+    char line[TERMINAL_MAX_LINE], *bulk;
+    int i, len, start, lines = argc > 1 ? atoi(argv[1]) : 0;
+    int bytes = BULK_LINES * LINE_BYTES;
+
+    memset(line, 'x', LINE_BYTES - 1);
+    line[LINE_BYTES - 1] = '\n';
+
+    start = GetTicks();
+    for (i = 0; i < BULK_LINES; ++i)
+        TtyWrite(1, line, LINE_BYTES);
+    bench_report("bench_tty", "write_lines", bytes, GetTicks() - start);
+
+    if ((bulk = malloc(bytes / BULK_CALLS)) == NULL)
+        Exit(ERROR);
+    for (i = 0; i < bytes / BULK_CALLS; ++i)
+        bulk[i] = i % LINE_BYTES == LINE_BYTES - 1 ? '\n' : 'y';
+
+    start = GetTicks();
+    for (i = 0; i < BULK_CALLS; ++i)
+        TtyWrite(1, bulk, bytes / BULK_CALLS);
+    bench_report("bench_tty", "write_bulk", bytes, GetTicks() - start);
+
+    if (lines <= 0)
+        Exit(0);
+
+    start = GetTicks();
+    for (i = 0; i < lines; ++i) {
+        if ((len = TtyRead(2, line, sizeof(line))) == ERROR)
+            Exit(ERROR);
+        TtyWrite(2, line, len);
+    }
+    bench_report("bench_tty", "echo", lines, GetTicks() - start);
+
+    Exit(0);
+}
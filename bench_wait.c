@@ -0,0 +1,44 @@
+#include "bench.h"
+
+/*
+ * Wait fan-in.
+ *
+ * Forks CHILDREN children at once and reaps them all with Wait. In the
+ * first case the children exit at once, so most are already gone when
+ * the parent waits; in the second each Delays first, so the parent
+ * blocks in Wait and is woken by each Exit.
+ */
+
+#define CHILDREN        32
+
+static int
+fan_in(int delay)
+{
+    int i, status, start = GetTicks();
+
+    for (i = 0; i < CHILDREN; ++i) {
+        if (Fork() == 0) {
+            if (delay)
+                Delay(1 + i % 4);
+            Exit(i);
+        }
+    }
+
+    for (i = 0; i < CHILDREN; ++i) {
+        if (Wait(&status) == ERROR) {
+            TracePrintf(0, "bench_wait: Wait failed\n");
+            Exit(ERROR);
+        }
+    }
+
+    return GetTicks() - start;
+}
+
+int
+main()
+{
+    bench_report("bench_wait", "exited", CHILDREN, fan_in(0));
+    bench_report("bench_wait", "blocked", CHILDREN, fan_in(1));
+
+    Exit(0);
+}
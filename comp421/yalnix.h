@@ -34,6 +34,39 @@
 #define YALNIX_WRITE_SECTOR	41
 #define YALNIX_DISK_STATS	42
 
+/* Kernel call numbers below here are extensions to the Yalnix interface */
+
+#define YALNIX_DISK_SYNC	43
+#define YALNIX_READ_SECTORS	44
+#define YALNIX_WRITE_SECTORS	45
+
+#define YALNIX_GET_TICKS	50
+#define YALNIX_GET_STATS	51
+#define YALNIX_PROFILE		52
+#define YALNIX_SPAWN		53
+#define YALNIX_POOL_SPAWN	54
+#define YALNIX_SHM_CREATE	55
+#define YALNIX_SHM_ATTACH	56
+#define YALNIX_SHM_DETACH	57
+
+/*
+ *  Operations for Profile(op).
+ */
+#define PROFILE_START		1
+#define PROFILE_STOP		2
+#define PROFILE_DUMP		3
+
+/*
+ *  Sectors at the end of the disk which the kernel keeps for swap,
+ *  none unless the kernel and programs are built with SWAP_SECTORS
+ *  set.  ReadSector and the other disk calls only accept sectors below
+ *  USER_SECTORS.
+ */
+#ifndef SWAP_SECTORS
+#define SWAP_SECTORS		0
+#endif
+#define USER_SECTORS		(NUMSECTORS - SWAP_SECTORS)
+
 /*
  *  All Yalnix kernel calls return ERROR in case of any error.
  */
@@ -61,8 +94,38 @@
  *  (not part of Lab 2)
  */
 struct diskstats {
-    int reads;		/* count of ReadSector calls completed */
-    int writes;		/* count of WriteSector calls completed */
+    int reads;		/* count of sectors read by ReadSector(s) */
+    int writes;		/* count of sectors written by WriteSector(s) */
+    int queue_depth;	/* requests queued or in service now */
+    int max_queue_depth;	/* most requests queued or in service at once */
+    int avg_queue_depth;	/* average depth seen by a new request, x100 */
+    int avg_seek;	/* average head movement per request, in sectors */
+    int latency_p50;	/* request latency percentiles, measured in */
+    int latency_p90;	/*   disk operations from submission until */
+    int latency_p99;	/*   completion, so 1 means no waiting */
+    int cache_hits;	/* sector lookups found in the buffer cache */
+    int cache_misses;	/* sector lookups not found in the cache */
+    int cache_evictions;	/* cached sectors replaced by another sector */
+    int cache_writebacks;	/* dirty sectors written to the disk */
+    int readahead;	/* sectors read ahead of sequential reads */
+    int readahead_hits;	/* reads satisfied by a read-ahead sector */
+};
+
+/*
+ *  The structure of values filled in by GetStats.
+ */
+struct procstats {
+    int pid;
+    int ticks_run;	/* clock ticks spent running */
+    int ticks_ready;	/* clock ticks spent ready to run */
+    int voluntary_switches;	/* times it blocked or gave up the CPU */
+    int involuntary_switches;	/* times it was preempted by the clock */
+    int page_faults;	/* memory exceptions taken */
+    int frames;		/* resident frames of its own, counting the kernel
+			   stack but not swapped out, zero or shared pages */
+    int tty_in;		/* bytes read from terminals */
+    int tty_out;	/* bytes written to terminals */
+    int syscalls;	/* kernel calls made */
 };
 
 /*
@@ -89,6 +152,18 @@ extern int CopyTo(int, void *, void *, int);
 extern int ReadSector(int, void *);
 extern int WriteSector(int, void *);
 extern int DiskStats(struct diskstats *);
+/* Extensions to the Yalnix kernel call interface */
+extern int DiskSync(void);
+extern int ReadSectors(int, int, void *);
+extern int WriteSectors(int, int, void *);
+extern int GetTicks(void);
+extern int GetStats(int, struct procstats *);
+extern int Profile(int);
+extern int Spawn(char *, char **);
+extern int PoolSpawn(char *, char **);
+extern int ShmCreate(int);
+extern void *ShmAttach(int);
+extern int ShmDetach(void *);
 
 /*
  *  A Yalnix library function: TtyPrintf(num, format, args) works like
@@ -37,23 +37,15 @@ SavedContext *ContextSwitchFunc(SavedContext *ctxp,
     struct process_info *curProc = (struct process_info *)p1;
     struct process_info *newProc = (struct process_info *)p2;
 
-    TracePrintf(1, "CONTEXT SWITCH: Current process - %d, New process - %d\n",
-        curProc->pid, newProc->pid);
+    TRACE_EVENT(TRACE_SWITCH, curProc->pid, newProc->pid);
+    ++curProc->switches;
 
     active_process = newProc;
 
     // Set region 0 page table to new process table
-    TracePrintf(2, "CONTEXT SWITCH: Writing new region 0 PT addr %p\n", newProc->page_table);
-    WriteRegister(REG_PTR0, (RCS421RegVal) newProc->page_table);
-    kernel_page_table[PAGE_TABLE_LEN - 1].pfn =
-        DOWN_TO_PAGE(newProc->page_table) >> PAGESHIFT;
+    load_page_table(newProc);
 
-    TracePrintf(2, "CONTEXT SWITCH: Flushing TLB\n");
-    // Flush region 0 entries from the TLB and page table entry from region 1
-    WriteRegister(REG_TLB_FLUSH, (RCS421RegVal) TLB_FLUSH_0);
-    WriteRegister(REG_TLB_FLUSH, (RCS421RegVal) (VMEM_LIMIT - PAGESIZE));
-
-    struct pte *active_page_table = VMEM_LIMIT - PAGESIZE;
+    struct pte *active_page_table = newProc->pt_vaddr;
     TracePrintf(2, "CONTEXT SWITCH: Kernel stack pfns: %d, %d, %d, %d\n",
         active_page_table[PAGE_TABLE_LEN - 4].pfn,
         active_page_table[PAGE_TABLE_LEN - 3].pfn,
@@ -70,29 +62,16 @@ SavedContext *ContextSwitchFunc(SavedContext *ctxp,
  *
  * ctxp is a pointer to a SavedContext object describing the state of the
  * system when the call to ContextSwitch was made.
- * p1 and p2 are both unused.
+ * p1 is a pointer to the pcb of the child process, p2 is unused.
  */
 SavedContext *ContextSwitchForkHelper(SavedContext *ctxp,
     void *p1, void *p2) {
-    int i;
-
-    struct pte *new_table_base = (struct pte *)(VMEM_1_LIMIT - 2 * PAGESIZE);
 
-    // Copy kernel stack
-    void *temp = VMEM_1_LIMIT - 3 * PAGESIZE;
-    for (i = PAGE_TABLE_LEN - KERNEL_STACK_PAGES; i < PAGE_TABLE_LEN; ++i) {
-        // Point temp at the assigned physical frame
-        kernel_page_table[PAGE_TABLE_LEN - 3].pfn =
-            (new_table_base + i)->pfn;
+    struct pte *new_table_base = ((struct process_info *)p1)->pt_vaddr;
 
-        // Flush TLB entry for temp
-        WriteRegister(REG_TLB_FLUSH, (RCS421RegVal)temp);
-
-        // Copy kernel stack contents to new physical frame
-        TracePrintf(2, "FORK: Calling memcpy, %x, %x\n", (unsigned int)temp,
-                    (unsigned int)(VMEM_0_BASE + i * PAGESIZE));
-        memcpy(temp, (const void *)(VMEM_0_BASE + i * PAGESIZE), PAGESIZE);
-    }
+    // Copy kernel stack contents to the new physical frames
+    copy_pages(new_table_base, PAGE_TABLE_LEN - KERNEL_STACK_PAGES,
+        PAGE_TABLE_LEN);
 
     // Return the current context so that the child process
     // has a copy of the current context
@@ -108,10 +87,9 @@ SavedContext *ContextSwitchInitHelper(SavedContext *ctxp,
     int i;
 
     //redefine the init PT pointer
-    struct pte *init_page_table = (struct pte *) (VMEM_LIMIT - PAGESIZE * 2);
-    //copy the Kernel Stack
+    struct pte *init_page_table = ((struct process_info *) p1)->pt_vaddr;
+    //allocate the Kernel Stack
     for (i = 0; i < KERNEL_STACK_PAGES; ++i) {
-        TracePrintf(2, "copying to %p from %p\n",(void*)(VMEM_LIMIT - 3 * PAGESIZE),(void*)(KERNEL_STACK_BASE + i * PAGESIZE));
         struct pte  init_stack_entry = {
             .pfn = alloc_page(),
             .unused = 0b00000,
@@ -119,21 +97,17 @@ SavedContext *ContextSwitchInitHelper(SavedContext *ctxp,
             .kprot = PROT_READ | PROT_WRITE,
             .valid = 0b1
         };
-        kernel_page_table[PAGE_TABLE_LEN - 3] = init_stack_entry;
         init_page_table[PAGE_TABLE_LEN - KERNEL_STACK_PAGES + i] = init_stack_entry;
-        WriteRegister(REG_TLB_FLUSH, (RCS421RegVal) (VMEM_LIMIT - PAGESIZE * 3));
-        memcpy((void*)(VMEM_LIMIT - 3 * PAGESIZE), (void*)(KERNEL_STACK_BASE + i * PAGESIZE), PAGESIZE);
     }
 
-    //Switch the idle region 0 Page Table for the Init Page Table
-    kernel_page_table[PAGE_TABLE_LEN - 1].pfn = (VMEM_LIMIT - PAGESIZE * 2) >> PAGESHIFT;
-    WriteRegister(REG_TLB_FLUSH, VMEM_LIMIT - PAGESIZE);
+    //copy the Kernel Stack
+    copy_pages(init_page_table, PAGE_TABLE_LEN - KERNEL_STACK_PAGES,
+        PAGE_TABLE_LEN);
 
-    //write the new Region 0 Page Table pointer to hardware and flush TLB
-    WriteRegister(REG_PTR0, (RCS421RegVal) init_page_table);
-    WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_0);
+    //Switch the idle region 0 Page Table for the Init Page Table
+    load_page_table((struct process_info *) p1);
 
-    active_process = (struct pte *) p1;
+    active_process = (struct process_info *) p1;
 
     return ctxp;
 }
@@ -160,7 +134,7 @@ SavedContext *ContextSwitchExitHelper(SavedContext *ctxp,
 
     TracePrintf(2, "Freeing page table of process %d\n", curProc->pid);
     // Free the process page table
-    free_page_table(active_process->page_table);
+    free_page_table(curProc);
 
     // Free the process pcb
     free(p1);
@@ -169,17 +143,37 @@ SavedContext *ContextSwitchExitHelper(SavedContext *ctxp,
     active_process = newProc;
 
     // Set region 0 page table to new process table
-    TracePrintf(2, "writing new region 0 PT addr %p\n", newProc->page_table);
-    WriteRegister(REG_PTR0, (RCS421RegVal) newProc->page_table);
-    kernel_page_table[PAGE_TABLE_LEN - 1].pfn =
-        DOWN_TO_PAGE(newProc->page_table) >> PAGESHIFT;
-
-    // Flush region 0 entries from the TLB and page table entry from region 1
-    WriteRegister(REG_TLB_FLUSH, (RCS421RegVal) TLB_FLUSH_0);
-    WriteRegister(REG_TLB_FLUSH, (RCS421RegVal) (VMEM_LIMIT - PAGESIZE));
+    load_page_table(newProc);
 
     // Reset the switch counter
     last_switch = clock_count;
 
     return &newProc->ctx;
 }
+
+/*
+ * Loads the region 0 page table of the given process.
+ *
+ * If the page table is already loaded, as when switching back to the
+ * process which was last running, the TLB entries for region 0 are
+ * still valid and the flushes are skipped.
+ */
+void load_page_table(struct process_info *pcb) {
+    ++switch_count;
+
+    if (pcb->page_table == loaded_page_table) {
+        TracePrintf(2, "CONTEXT SWITCH: Region 0 PT %p already loaded\n",
+            pcb->page_table);
+        return;
+    }
+
+    TracePrintf(2, "CONTEXT SWITCH: Writing new region 0 PT addr %p\n",
+        pcb->page_table);
+    WriteRegister(REG_PTR0, (RCS421RegVal) pcb->page_table);
+    loaded_page_table = pcb->page_table;
+
+    // Flush region 0 entries from the TLB. The page table itself is
+    // permanently mapped in the window, so region 1 is left alone.
+    flush_tlb(TLB_FLUSH_0);
+    ++switch_flushes;
+}
@@ -0,0 +1,761 @@
+#include <string.h>
+
+#include "kernel.h"
+
+/*
+ * Disk driver and sector buffer cache.
+ *
+ * Sectors are read and written through a cache of up to CACHE_BLOCKS
+ * region 1 buffers, hashed by sector number and kept in LRU order.
+ * ReadSector only goes to the disk when the sector is not cached.
+ * WriteSector just updates the cached copy and marks it dirty, so
+ * repeated writes to a sector are coalesced into the one disk write
+ * made when the block is evicted or DiskSync is called.
+ *
+ * A block which needs the disk is queued, and the disk services one
+ * block at a time. Processes which need the block block on it until
+ * the transfer is done. When the disk raises TRAP_DISK, they are made
+ * runnable and the next queued block is started straight away, so the
+ * disk never idles while work is queued. The disk may transfer data
+ * while another process's region 0 is mapped, which is why the buffers
+ * live in region 1. Data is copied between them and the user's buffer
+ * in the context of the calling process.
+ *
+ * Reads are also matched against a few recent sequential streams,
+ * which need not come from the same process, so a file server reading
+ * for several clients is still seen as sequential. A stream which
+ * keeps going is read ahead by a window of sectors which doubles with
+ * each sequential read, and halves when a sector read ahead was
+ * evicted before it was wanted. Read-ahead never blocks; it gives up
+ * when no clean block is free.
+ *
+ * Queued blocks are kept in arrival order. Under DISK_CLOOK the next
+ * block is the one with the lowest sector at or beyond the head,
+ * wrapping around to the lowest sector once none is left ahead,
+ * unless the oldest block has waited past DISK_DEADLINE.
+ */
+
+/*
+ * Removes and returns the queued block which should be serviced next
+ * under DISK_POLICY.
+ */
+static struct cache_block *pick_request(void) {
+    struct cache_block *req, *prev;
+    struct cache_block *best = disk_queue, *best_prev = NULL;
+    struct cache_block *lowest = disk_queue, *lowest_prev = NULL;
+
+    if (DISK_POLICY == DISK_CLOOK && (DISK_DEADLINE == 0
+        || disk_ops_done - disk_queue->submitted < DISK_DEADLINE)) {
+        best = NULL;
+
+        for (prev = NULL, req = disk_queue; req != NULL;
+            prev = req, req = req->next) {
+            if (req->sector < lowest->sector) {
+                lowest = req;
+                lowest_prev = prev;
+            }
+
+            if (req->sector >= disk_head_sector
+                && (best == NULL || req->sector < best->sector)) {
+                best = req;
+                best_prev = prev;
+            }
+        }
+
+        // Nothing left ahead of the head, sweep again from the start
+        if (best == NULL) {
+            best = lowest;
+            best_prev = lowest_prev;
+        }
+    }
+
+    if (best_prev == NULL)
+        disk_queue = best->next;
+    else
+        best_prev->next = best->next;
+
+    if (disk_queue_tail == best)
+        disk_queue_tail = best_prev;
+
+    return best;
+}
+
+/*
+ * Starts the next queued block, if the disk is idle.
+ */
+static void start_next_request(void) {
+    if (disk_active != NULL || disk_queue == NULL)
+        return;
+
+    disk_active = pick_request();
+
+    disk_seek_total += disk_active->sector > disk_head_sector ?
+        disk_active->sector - disk_head_sector :
+        disk_head_sector - disk_active->sector;
+    disk_head_sector = disk_active->sector;
+
+    TRACE_EVENT(TRACE_DISK_START, disk_active->sector, disk_active->op);
+
+    DiskAccess(disk_active->op, disk_active->sector, disk_active->data);
+}
+
+/*
+ * Queues block to be read from or written to the disk.
+ *
+ * Does not wait for the transfer; see wait_block.
+ */
+static void start_io(struct cache_block *block, int op) {
+    block->busy = 1;
+    block->op = op;
+    block->submitted = disk_ops_done;
+    block->next = NULL;
+
+    disk_depth_total += disk_stats.queue_depth;
+    if (++disk_stats.queue_depth > disk_stats.max_queue_depth)
+        disk_stats.max_queue_depth = disk_stats.queue_depth;
+
+    if (disk_queue == NULL)
+        disk_queue = block;
+    else
+        disk_queue_tail->next = block;
+    disk_queue_tail = block;
+
+    start_next_request();
+}
+
+/*
+ * Blocks the active process until the disk has finished with block.
+ *
+ * The block may be queued again before a woken waiter runs, in which
+ * case it waits for that transfer too.
+ */
+static void wait_block(struct cache_block *block) {
+    while (block->busy) {
+        push_process(&block->waiters, &block->waiters_tail, active_process);
+        RemoveSwitch();
+    }
+}
+
+/*
+ * Queues a dirty block to be written back to the disk.
+ */
+static void write_back(struct cache_block *block) {
+    block->dirty = 0;
+    ++disk_stats.cache_writebacks;
+
+    start_io(block, DISK_WRITE);
+}
+
+/*
+ * Returns the cached block holding sector, or NULL.
+ */
+static struct cache_block *cache_find(int sector) {
+    struct cache_block *block = cache_table[sector % CACHE_HASH_SIZE];
+
+    while (block != NULL && block->sector != sector)
+        block = block->hash_next;
+
+    return block;
+}
+
+/*
+ * Moves block to the most recently used end of the LRU list.
+ */
+static void cache_touch(struct cache_block *block) {
+    if (cache_lru == block)
+        return;
+
+    // Unlink the block, if it is on the list yet
+    if (block->lru_prev != NULL)
+        block->lru_prev->lru_next = block->lru_next;
+    if (block->lru_next != NULL)
+        block->lru_next->lru_prev = block->lru_prev;
+    else if (cache_lru_tail == block)
+        cache_lru_tail = block->lru_prev;
+
+    block->lru_prev = NULL;
+    block->lru_next = cache_lru;
+    if (cache_lru != NULL)
+        cache_lru->lru_prev = block;
+    cache_lru = block;
+
+    if (cache_lru_tail == NULL)
+        cache_lru_tail = block;
+}
+
+/*
+ * Moves block to the hash chain for sector. Its contents become
+ * invalid.
+ */
+static void cache_rehash(struct cache_block *block, int sector) {
+    struct cache_block **link;
+
+    if (block->sector >= 0) {
+        link = &cache_table[block->sector % CACHE_HASH_SIZE];
+        while (*link != block)
+            link = &(*link)->hash_next;
+        *link = block->hash_next;
+    }
+
+    block->sector = sector;
+    block->valid = 0;
+    block->prefetched = 0;
+    block->hash_next = cache_table[sector % CACHE_HASH_SIZE];
+    cache_table[sector % CACHE_HASH_SIZE] = block;
+}
+
+/*
+ * Returns a block the cache may reuse, or NULL if every block is busy.
+ *
+ * Allocates new blocks until there are CACHE_BLOCKS of them, then
+ * reuses the least recently used block which is not busy.
+ */
+static struct cache_block *cache_victim(void) {
+    struct cache_block *block;
+
+    if (cache_count < CACHE_BLOCKS
+        && (block = malloc(sizeof(struct cache_block))) != NULL) {
+        ++cache_count;
+        *block = (struct cache_block) {
+            .sector = -1,
+            .valid = 0,
+            .dirty = 0,
+            .busy = 0,
+            .prefetched = 0,
+            .waiters = NULL,
+            .waiters_tail = NULL,
+            .next = NULL,
+            .hash_next = NULL,
+            .lru_prev = NULL,
+            .lru_next = NULL
+        };
+        return block;
+    }
+
+    for (block = cache_lru_tail; block != NULL; block = block->lru_prev) {
+        if (!block->busy)
+            return block;
+    }
+
+    return NULL;
+}
+
+/*
+ * Returns the block caching sector, assigning it one if necessary.
+ *
+ * The block is not busy, but its contents are only valid if it
+ * already held the sector. May block the active process, to wait for
+ * the disk to finish with the block or to write back a dirty block
+ * which is being reused.
+ *
+ * Returns NULL if the cache has no blocks and none can be allocated.
+ */
+static struct cache_block *get_block(int sector) {
+    struct cache_block *block;
+
+    while (1) {
+        if ((block = cache_find(sector)) != NULL) {
+            if (block->busy) {
+                wait_block(block);
+                continue;
+            }
+
+            cache_touch(block);
+            return block;
+        }
+
+        if ((block = cache_victim()) == NULL) {
+            if (cache_lru_tail == NULL)
+                return NULL;
+
+            // Every block is busy, wait for the oldest
+            wait_block(cache_lru_tail);
+            continue;
+        }
+
+        // The block may be found, or reused, while it is written back
+        if (block->dirty) {
+            write_back(block);
+            wait_block(block);
+            continue;
+        }
+
+        if (block->sector >= 0)
+            ++disk_stats.cache_evictions;
+
+        cache_rehash(block, sector);
+        cache_touch(block);
+        return block;
+    }
+}
+
+/*
+ * Notes a read of sector for read-ahead, and queues reads of the
+ * sectors expected to follow it. hit says whether sector was cached.
+ */
+static void read_ahead(int sector, int hit) {
+    struct readahead_stream *stream = NULL;
+    struct readahead_stream *oldest = &readahead_streams[0];
+    struct cache_block *block;
+    int i, last;
+
+    if (READAHEAD_MAX == 0)
+        return;
+
+    for (i = 0; i < READAHEAD_STREAMS; ++i) {
+        if (readahead_streams[i].used != 0
+            && readahead_streams[i].next == sector) {
+            stream = &readahead_streams[i];
+            break;
+        }
+        if (readahead_streams[i].used < oldest->used)
+            oldest = &readahead_streams[i];
+    }
+
+    // Not part of a stream, start tracking a new one
+    if (stream == NULL) {
+        *oldest = (struct readahead_stream) {
+            .next = sector + 1,
+            .window = 0,
+            .end = sector + 1,
+            .used = ++readahead_clock
+        };
+        return;
+    }
+
+    // A miss on a sector already read ahead means the window is too
+    // large for the cache to hold
+    if (!hit && sector < stream->end)
+        stream->window = stream->window / 2 > READAHEAD_MIN ?
+            stream->window / 2 : READAHEAD_MIN;
+    else if (stream->window < READAHEAD_MIN)
+        stream->window = READAHEAD_MIN;
+    else if (stream->window < READAHEAD_MAX)
+        stream->window *= 2;
+
+    stream->next = sector + 1;
+    stream->used = ++readahead_clock;
+
+    last = sector + stream->window < USER_SECTORS ?
+        sector + stream->window : USER_SECTORS - 1;
+
+    for (i = stream->end > sector ? stream->end : sector + 1; i <= last; ++i) {
+        if (cache_find(i) != NULL)
+            continue;
+
+        if ((block = cache_victim()) == NULL || block->dirty)
+            break;
+
+        if (block->sector >= 0)
+            ++disk_stats.cache_evictions;
+
+        cache_rehash(block, i);
+        cache_touch(block);
+        block->prefetched = 1;
+        ++disk_stats.readahead;
+
+        start_io(block, DISK_READ);
+    }
+
+    stream->end = i;
+}
+
+/*
+ * Writes back every dirty block in the cache, and waits until the disk
+ * has finished with all of them.
+ */
+void disk_sync(void) {
+    struct cache_block *block;
+    int waited = 1;
+
+    // Queue all the writes first, so the scheduler can order them
+    for (block = cache_lru; block != NULL; block = block->lru_next) {
+        if (block->dirty && !block->busy)
+            write_back(block);
+    }
+
+    // Waiting can reorder the LRU list, so rescan after each wait
+    while (waited) {
+        waited = 0;
+        for (block = cache_lru; block != NULL; block = block->lru_next) {
+            if (block->busy) {
+                wait_block(block);
+                waited = 1;
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Queues a read of sector unless it is cached or already on its way,
+ * without waiting for it.
+ *
+ * Returns 1 if the sector was cached or on its way, 0 if a read was
+ * queued, or ERROR if no cache block could be found for it.
+ */
+static int queue_read(int sector) {
+    struct cache_block *block = cache_find(sector);
+    int hit = 1;
+
+    if (block == NULL || (!block->valid && !block->busy)) {
+        if ((block = get_block(sector)) == NULL)
+            return ERROR;
+
+        if (!block->valid) {
+            hit = 0;
+            start_io(block, DISK_READ);
+        }
+    }
+
+    if (hit)
+        ++disk_stats.cache_hits;
+    else
+        ++disk_stats.cache_misses;
+
+    return hit;
+}
+
+/*
+ * Waits for sector to be read into the cache, then copies it to buf.
+ *
+ * Returns 0 on success, ERROR if no cache block could be found for it
+ * or buf is no longer a valid buffer.
+ */
+static int copy_out(int sector, void *buf) {
+    struct cache_block *block;
+    unsigned int switches;
+
+    // Faulting the buffer in may block, and the block be reused, so
+    // start again until it is faulted in without blocking
+    do {
+        // The block may be reused again before we run after the read
+        while ((block = get_block(sector)) != NULL && !block->valid) {
+            start_io(block, DISK_READ);
+            wait_block(block);
+        }
+
+        if (block == NULL)
+            return ERROR;
+
+        // The buffer may have been shared or paged out while we were
+        // blocked
+        switches = active_process->switches;
+        if (fault_in_pages(buf, SECTORSIZE, 1) == ERROR)
+            return ERROR;
+    } while (active_process->switches != switches);
+
+    if (block->prefetched) {
+        block->prefetched = 0;
+        ++disk_stats.readahead_hits;
+    }
+
+    memcpy(buf, block->data, SECTORSIZE);
+
+    ++disk_stats.reads;
+
+    return 0;
+}
+
+/*
+ * Copies buf into the cache block for sector and marks it dirty.
+ *
+ * Returns 0 on success, ERROR if no cache block could be found for it
+ * or buf is no longer a valid buffer.
+ */
+static int copy_in(int sector, void *buf) {
+    struct cache_block *block;
+    unsigned int switches;
+
+    // As in copy_out, the block may be reused while the buffer is
+    // faulted in
+    do {
+        if ((block = get_block(sector)) == NULL)
+            return ERROR;
+
+        switches = active_process->switches;
+        if (fault_in_pages(buf, SECTORSIZE, 0) == ERROR)
+            return ERROR;
+    } while (active_process->switches != switches);
+
+    if (block->valid)
+        ++disk_stats.cache_hits;
+    else
+        ++disk_stats.cache_misses;
+
+    memcpy(block->data, buf, SECTORSIZE);
+    block->valid = 1;
+    block->dirty = 1;
+
+    ++disk_stats.writes;
+
+    return 0;
+}
+
+/*
+ * Reads or writes swap slot, the page of sectors after USER_SECTORS
+ * which holds it, from or to the frame pfn. The sectors go through
+ * swap_blocks rather than the cache, and are queued all at once.
+ * Only one process may use swap_blocks at a time.
+ */
+void swap_io(int op, unsigned int slot, unsigned int pfn) {
+    int i;
+
+    if (op == DISK_WRITE) {
+        map_copy_slot(0, pfn);
+        flush_tlb((RCS421RegVal)COPY_SLOT(0));
+    }
+
+    for (i = 0; i < SECTORS_PER_PAGE; ++i) {
+        swap_blocks[i].sector = USER_SECTORS + slot * SECTORS_PER_PAGE + i;
+        if (op == DISK_WRITE)
+            memcpy(swap_blocks[i].data, (char *)COPY_SLOT(0) + i * SECTORSIZE,
+                SECTORSIZE);
+        start_io(&swap_blocks[i], op);
+    }
+
+    for (i = SECTORS_PER_PAGE - 1; i >= 0; --i)
+        wait_block(&swap_blocks[i]);
+
+    if (op == DISK_READ) {
+        // The copy slot may have been used while we were blocked
+        map_copy_slot(0, pfn);
+        flush_tlb((RCS421RegVal)COPY_SLOT(0));
+        for (i = 0; i < SECTORS_PER_PAGE; ++i)
+            memcpy((char *)COPY_SLOT(0) + i * SECTORSIZE, swap_blocks[i].data,
+                SECTORSIZE);
+    }
+}
+
+/*
+ * Implements the ReadSector() kernel call.
+ *
+ * Reads the disk sector into buf, which must hold SECTORSIZE bytes.
+ *
+ * Returns 0 on success, ERROR if the sector number is invalid or buf
+ * is not a valid buffer.
+ */
+int KernelReadSector(int sector, void *buf) {
+    int hit;
+
+    TracePrintf(1, "READSECTOR: pid = %d, sector = %d\n",
+        active_process->pid, sector);
+
+    if (sector < 0 || sector >= USER_SECTORS
+        || fault_in_pages(buf, SECTORSIZE, 1) == ERROR)
+        return ERROR;
+
+    if ((hit = queue_read(sector)) == ERROR)
+        return ERROR;
+
+    // Queue the sectors expected next behind this one
+    read_ahead(sector, hit);
+
+    return copy_out(sector, buf);
+}
+
+/*
+ * Implements the WriteSector() kernel call.
+ *
+ * Writes SECTORSIZE bytes from buf to the disk sector. The data goes
+ * to the buffer cache, and reaches the disk when the block is evicted
+ * or the cache is synced.
+ *
+ * Returns 0 on success, ERROR if the sector number is invalid or buf
+ * is not a valid buffer.
+ */
+int KernelWriteSector(int sector, void *buf) {
+    TracePrintf(1, "WRITESECTOR: pid = %d, sector = %d\n",
+        active_process->pid, sector);
+
+    if (sector < 0 || sector >= USER_SECTORS
+        || fault_in_pages(buf, SECTORSIZE, 0) == ERROR)
+        return ERROR;
+
+    return copy_in(sector, buf);
+}
+
+/*
+ * Implements the ReadSectors() kernel call.
+ *
+ * Reads count consecutive sectors, starting at start, into buf, which
+ * must hold count * SECTORSIZE bytes. Up to DISK_BATCH sectors are
+ * queued at once before any is waited for, so the scheduler can
+ * order them and the caller blocks once per batch rather than once
+ * per sector.
+ *
+ * Returns 0 on success, ERROR if the range of sectors is invalid, buf
+ * is not a valid buffer, or the cache has no blocks.
+ */
+int KernelReadSectors(int start, int count, void *buf) {
+    struct cache_block *block;
+    int hits[DISK_BATCH];
+    int done, batch, i;
+
+    TracePrintf(1, "READSECTORS: pid = %d, start = %d, count = %d\n",
+        active_process->pid, start, count);
+
+    if (start < 0 || count <= 0 || count > USER_SECTORS - start
+        || fault_in_pages(buf, count * SECTORSIZE, 1) == ERROR)
+        return ERROR;
+
+    for (done = 0; done < count; done += batch) {
+        batch = count - done < DISK_BATCH ? count - done : DISK_BATCH;
+
+        for (i = 0; i < batch; ++i) {
+            if ((hits[i] = queue_read(start + done + i)) == ERROR)
+                return ERROR;
+        }
+
+        // Read ahead of the batch only once all of it is queued
+        for (i = 0; i < batch; ++i)
+            read_ahead(start + done + i, hits[i]);
+
+        // Waiting for the last sector first usually finds the rest done,
+        // so we are woken once per batch rather than once per sector
+        for (i = batch - 1; i >= 0; --i) {
+            if ((block = cache_find(start + done + i)) != NULL)
+                wait_block(block);
+        }
+
+        for (i = 0; i < batch; ++i) {
+            if (copy_out(start + done + i,
+                (char *)buf + (done + i) * SECTORSIZE) == ERROR)
+                return ERROR;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Implements the WriteSectors() kernel call.
+ *
+ * Writes count * SECTORSIZE bytes from buf to count consecutive
+ * sectors, starting at start. Like WriteSector, the data goes to the
+ * buffer cache.
+ *
+ * Returns 0 on success, ERROR if the range of sectors is invalid, buf
+ * is not a valid buffer, or the cache has no blocks.
+ */
+int KernelWriteSectors(int start, int count, void *buf) {
+    int i;
+
+    TracePrintf(1, "WRITESECTORS: pid = %d, start = %d, count = %d\n",
+        active_process->pid, start, count);
+
+    if (start < 0 || count <= 0 || count > USER_SECTORS - start
+        || fault_in_pages(buf, count * SECTORSIZE, 0) == ERROR)
+        return ERROR;
+
+    for (i = 0; i < count; ++i) {
+        if (copy_in(start + i, (char *)buf + i * SECTORSIZE) == ERROR)
+            return ERROR;
+    }
+
+    return 0;
+}
+
+/*
+ * Implements the DiskSync() kernel call.
+ *
+ * Writes every dirty sector in the buffer cache to the disk, returning
+ * once they are all written.
+ *
+ * Returns 0.
+ */
+int KernelDiskSync(void) {
+    TracePrintf(1, "DISKSYNC: pid = %d\n", active_process->pid);
+
+    disk_sync();
+
+    return 0;
+}
+
+/*
+ * Returns the smallest request latency, in disk operations, which at
+ * least percent percent of completed requests did not exceed.
+ */
+static int latency_percentile(unsigned int requests, int percent) {
+    unsigned int seen = 0;
+    int i;
+
+    for (i = 0; i < DISK_LATENCY_BUCKETS - 1; ++i) {
+        seen += disk_latency[i];
+        if (100 * seen >= percent * requests)
+            break;
+    }
+
+    return i;
+}
+
+/*
+ * Implements the DiskStats() kernel call.
+ *
+ * Copies the disk statistics into the struct pointed to by stats.
+ *
+ * Returns 0 on success, ERROR if stats is not a valid buffer.
+ */
+int KernelDiskStats(struct diskstats *stats) {
+    unsigned int requests = disk_ops_done;
+
+    if (fault_in_pages(stats, sizeof(struct diskstats), 1) == ERROR)
+        return ERROR;
+
+    if (requests > 0) {
+        disk_stats.avg_queue_depth = 100 * disk_depth_total / requests;
+        disk_stats.avg_seek = disk_seek_total / requests;
+        disk_stats.latency_p50 = latency_percentile(requests, 50);
+        disk_stats.latency_p90 = latency_percentile(requests, 90);
+        disk_stats.latency_p99 = latency_percentile(requests, 99);
+    }
+
+    *stats = disk_stats;
+
+    return 0;
+}
+
+/*
+ * Interrupt handler for TRAP_DISK interrupt.
+ *
+ * Wakes the processes waiting for the completed block and starts the
+ * next one. If the machine was idle, switches to a woken process
+ * rather than waiting for the next clock tick.
+ */
+void trap_disk_handler(ExceptionInfo *exceptionInfo) {
+    struct cache_block *block = disk_active;
+    struct process_info *pcb;
+    unsigned int latency;
+
+    record_trap(exceptionInfo);
+
+    if (block == NULL)
+        return;
+
+    TRACE_EVENT(TRACE_DISK_DONE, block->sector, block->op);
+
+    disk_active = NULL;
+    block->busy = 0;
+    if (block->op == DISK_READ)
+        block->valid = 1;
+
+    while ((pcb = pop_process(&block->waiters, &block->waiters_tail)) != NULL)
+        push_process(&process_queue, &pq_tail, pcb);
+
+    // Count the request's latency in completed disk operations
+    latency = ++disk_ops_done - block->submitted;
+    ++disk_latency[latency < DISK_LATENCY_BUCKETS ?
+        latency : DISK_LATENCY_BUCKETS - 1];
+    --disk_stats.queue_depth;
+
+    start_next_request();
+
+    // A write back may have had no one waiting for it
+    if (active_process == idle && process_queue != NULL) {
+        struct process_info *next = pop_process(&process_queue, &pq_tail);
+
+        last_switch = clock_count;
+        ContextSwitch(ContextSwitchFunc, &idle->ctx, (void *)idle,
+            (void *)next);
+    }
+}
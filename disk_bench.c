@@ -0,0 +1,60 @@
+#include <comp421/hardware.h>
+#include <comp421/yalnix.h>
+
+/*
+ * Disk scheduling benchmark.
+ *
+ * NUM_WORKERS processes each read READS_EACH randomly chosen sectors
+ * at the same time, so the queue stays deep and the scheduling policy
+ * decides the order the disk sees. Prints the queue depth, seek
+ * distance and latency figures from DiskStats, to compare kernels
+ * built with different DISK_POLICY and DISK_DEADLINE settings.
+ */
+
+#define NUM_WORKERS     8
+#define READS_EACH      64
+
+static int
+worker(int n)
+{
+    char buf[SECTORSIZE];
+    unsigned int seed = 12345 + 1000 * n;
+    int i, errors = 0;
+
+    for (i = 0; i < READS_EACH; ++i) {
+        seed = seed * 1103515245 + 12345;
+        if (ReadSector((seed >> 8) % USER_SECTORS, buf) == ERROR)
+            ++errors;
+    }
+
+    return errors;
+}
+
+int
+main()
+{
+    struct diskstats stats;
+    int n, status, start, errors = 0;
+
+    start = GetTicks();
+    for (n = 0; n < NUM_WORKERS; ++n) {
+        if (Fork() == 0)
+            Exit(worker(n));
+    }
+
+    for (n = 0; n < NUM_WORKERS; ++n) {
+        Wait(&status);
+        errors += status;
+    }
+
+    DiskStats(&stats);
+    TracePrintf(0, "disk_bench: %d reads in %d ticks, %d errors\n",
+        stats.reads, GetTicks() - start, errors);
+    TracePrintf(0, "disk_bench: queue depth avg %d.%02d max %d, "
+        "avg seek %d sectors\n", stats.avg_queue_depth / 100,
+        stats.avg_queue_depth % 100, stats.max_queue_depth, stats.avg_seek);
+    TracePrintf(0, "disk_bench: latency p50 %d p90 %d p99 %d operations\n",
+        stats.latency_p50, stats.latency_p90, stats.latency_p99);
+
+    Exit(errors ? ERROR : 0);
+}
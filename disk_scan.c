@@ -0,0 +1,53 @@
+#include <comp421/hardware.h>
+#include <comp421/yalnix.h>
+
+/*
+ * Sequential disk scan benchmark.
+ *
+ * Reads every sector users may access in order, which is the whole
+ * disk unless the kernel keeps some for swap, one ReadSector call at
+ * a time, and reports how long the scan took and how much of
+ * it read-ahead served. Compare against a kernel built with
+ * -DREADAHEAD_MAX=0. Then scans the disk again with ReadSectors,
+ * CHUNK sectors per call.
+ */
+
+#define CHUNK   32
+
+int
+main()
+{
+    struct diskstats before, after;
+    static char buf[CHUNK * SECTORSIZE];
+    int sector, start, ticks, count, errors = 0;
+
+    DiskStats(&before);
+    start = GetTicks();
+
+    for (sector = 0; sector < USER_SECTORS; ++sector) {
+        if (ReadSector(sector, buf) == ERROR)
+            ++errors;
+    }
+
+    ticks = GetTicks() - start;
+    DiskStats(&after);
+
+    TracePrintf(0, "disk_scan: %d sectors in %d ticks, %d errors\n",
+        USER_SECTORS, ticks, errors);
+    TracePrintf(0, "disk_scan: %d misses, %d read ahead, %d read-ahead hits\n",
+        after.cache_misses - before.cache_misses,
+        after.readahead - before.readahead,
+        after.readahead_hits - before.readahead_hits);
+
+    start = GetTicks();
+    for (sector = 0; sector < USER_SECTORS; sector += count) {
+        count = USER_SECTORS - sector < CHUNK ? USER_SECTORS - sector : CHUNK;
+        if (ReadSectors(sector, count, buf) == ERROR)
+            ++errors;
+    }
+
+    TracePrintf(0, "disk_scan: %d sectors in %d ticks with ReadSectors of "
+        "%d, %d errors\n", USER_SECTORS, GetTicks() - start, CHUNK, errors);
+
+    Exit(errors ? ERROR : 0);
+}
@@ -0,0 +1,145 @@
+#include <comp421/hardware.h>
+#include <comp421/yalnix.h>
+
+/*
+ * Disk driver test.
+ *
+ * NUM_WORKERS processes write a pattern to their own stripe of
+ * sectors at the same time, so that requests queue up behind each
+ * other, then read the sectors back and check them. Then rewrites one
+ * sector repeatedly, and checks the writes were coalesced into a
+ * single disk write by DiskSync. Finally writes and reads back a range
+ * larger than the cache with WriteSectors and ReadSectors.
+ */
+
+#define NUM_WORKERS     4
+#define SECTORS_EACH    32
+
+// Range moved by WriteSectors and ReadSectors
+#define RANGE_START     200
+#define RANGE_COUNT     100
+
+static void
+fill(char *buf, int sector)
+{
+    int i;
+
+    for (i = 0; i < SECTORSIZE; ++i)
+        buf[i] = (char)(sector + i);
+}
+
+static int
+worker(int n)
+{
+    char buf[SECTORSIZE], expect[SECTORSIZE];
+    int i, j, sector, errors = 0;
+
+    for (i = 0; i < SECTORS_EACH; ++i) {
+        sector = i * NUM_WORKERS + n;
+        fill(buf, sector);
+        if (WriteSector(sector, buf) == ERROR)
+            ++errors;
+    }
+
+    for (i = SECTORS_EACH - 1; i >= 0; --i) {
+        sector = i * NUM_WORKERS + n;
+        fill(expect, sector);
+        if (ReadSector(sector, buf) == ERROR)
+            ++errors;
+        for (j = 0; j < SECTORSIZE; ++j) {
+            if (buf[j] != expect[j]) {
+                TracePrintf(0, "disk_test: sector %d byte %d is wrong\n",
+                    sector, j);
+                ++errors;
+                break;
+            }
+        }
+    }
+
+    return errors;
+}
+
+static int
+check_range(void)
+{
+    static char buf[RANGE_COUNT * SECTORSIZE];
+    int i, errors = 0;
+
+    for (i = 0; i < RANGE_COUNT; ++i)
+        fill(buf + i * SECTORSIZE, RANGE_START + i);
+    if (WriteSectors(RANGE_START, RANGE_COUNT, buf) == ERROR)
+        ++errors;
+
+    for (i = 0; i < RANGE_COUNT * SECTORSIZE; ++i)
+        buf[i] = 0;
+    if (ReadSectors(RANGE_START, RANGE_COUNT, buf) == ERROR)
+        ++errors;
+
+    for (i = 0; i < RANGE_COUNT * SECTORSIZE; ++i) {
+        if (buf[i] != (char)(RANGE_START + i / SECTORSIZE + i % SECTORSIZE)) {
+            TracePrintf(0, "disk_test: ReadSectors byte %d is wrong\n", i);
+            ++errors;
+            break;
+        }
+    }
+
+    if (ReadSectors(USER_SECTORS - 1, 2, buf) != ERROR
+        || ReadSectors(0, 0, buf) != ERROR
+        || WriteSectors(-1, 1, buf) != ERROR) {
+        TracePrintf(0, "disk_test: accepted an invalid range\n");
+        ++errors;
+    }
+
+    return errors;
+}
+
+int
+main()
+{
+    struct diskstats stats;
+    char buf[SECTORSIZE];
+    int n, status, start, writebacks, errors = 0;
+
+    if (ReadSector(-1, buf) != ERROR || ReadSector(USER_SECTORS, buf) != ERROR
+        || WriteSector(USER_SECTORS, buf) != ERROR) {
+        TracePrintf(0, "disk_test: accepted an invalid sector\n");
+        ++errors;
+    }
+
+    start = GetTicks();
+    for (n = 0; n < NUM_WORKERS; ++n) {
+        if (Fork() == 0)
+            Exit(worker(n));
+    }
+
+    for (n = 0; n < NUM_WORKERS; ++n) {
+        Wait(&status);
+        errors += status;
+    }
+
+    errors += check_range();
+
+    DiskSync();
+    DiskStats(&stats);
+    writebacks = stats.cache_writebacks;
+
+    for (n = 0; n < 16; ++n) {
+        fill(buf, n);
+        WriteSector(USER_SECTORS - 1, buf);
+    }
+    DiskSync();
+    DiskStats(&stats);
+    if (stats.cache_writebacks != writebacks + 1) {
+        TracePrintf(0, "disk_test: %d writebacks for one dirty sector\n",
+            stats.cache_writebacks - writebacks);
+        ++errors;
+    }
+
+    TracePrintf(0, "disk_test: %d reads, %d writes in %d ticks, %d errors\n",
+        stats.reads, stats.writes, GetTicks() - start, errors);
+    TracePrintf(0, "disk_test: cache %d hits, %d misses, %d evictions, "
+        "%d writebacks\n", stats.cache_hits, stats.cache_misses,
+        stats.cache_evictions, stats.cache_writebacks);
+
+    Exit(errors ? ERROR : 0);
+}
@@ -0,0 +1,1388 @@
+/*
+ *  Host-side stand-in for the COMP 421 hardware.
+ *
+ *  Implements the hardware.h interface on plain Linux so that the
+ *  unmodified kernel sources can be linked into a host executable and
+ *  run end to end.  The pieces are:
+ *
+ *   - Physical memory is a memfd of pmem_size bytes.  Virtual pages in
+ *     [0, VMEM_LIMIT) of the host address space are mapped onto frames
+ *     of that file on demand.
+ *   - The host mappings that currently exist *are* the TLB.  A SIGSEGV
+ *     on a simulated address is a TLB miss: the page tables named by
+ *     REG_PTR0/REG_PTR1 are walked, the entry is cached (FIFO, with a
+ *     configurable capacity) and the page is mapped with the protection
+ *     of the current mode.  REG_TLB_FLUSH unmaps cached entries.
+ *   - User programs trap with ud2 (see hostsim.h).  The trap, fault and
+ *     interrupt paths switch onto the Region 0 kernel stack, push a
+ *     trap frame there and call through REG_VECTOR_BASE, just like the
+ *     real machine.  Returning to user mode goes through a SIGUSR2
+ *     handler that loads the (possibly modified) trap frame.
+ *   - ContextSwitch is built on getcontext/setcontext, running the
+ *     kernel's switch function on a separate host stack.
+ *   - The clock is an interval timer; TTY input comes from a script of
+ *     (tick, terminal, text) lines; TTY output goes to TTYLOG.<n>;
+ *     the disk is the file DISK with a simple seek-time model.
+ *   - With -r, interrupts are replayed from the REPLAY lines a kernel
+ *     wrote to an earlier TRACE file instead of coming from the timer
+ *     and the devices (see take_replay).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+
+#include <comp421/hardware.h>
+#include <comp421/yalnix.h>
+
+#include "hostsim.h"
+
+#define SIM_LO          PAGESIZE
+#define SIM_LEN         (VMEM_LIMIT - SIM_LO)
+
+#define MODE_KERNEL     0
+#define MODE_USER       1
+
+#define TLB_MAX         1024
+
+#define ALTSTACK_SIZE   (64 * 1024)
+#define SWSTACK_SIZE    (64 * 1024)
+
+/*
+ *  Pending interrupt bits, delivered in this order.
+ */
+#define PEND_CLOCK      (1 << 0)
+#define PEND_RECEIVE(t) (1 << (1 + (t)))
+#define PEND_TRANSMIT(t) (1 << (1 + NUM_TERMINALS + (t)))
+#define PEND_DISK       (1 << (1 + 2 * NUM_TERMINALS))
+
+/*
+ *  The kernel image occupies [VMEM_1_BASE, _etext) for text.
+ */
+__asm__(".globl _etext\n\t.set _etext, 0x210000");
+_Static_assert(VMEM_1_BASE + SIM_KERNEL_TEXT_PAGES * PAGESIZE == 0x210000,
+    "_etext must match SIM_KERNEL_TEXT_PAGES");
+
+/*
+ *  Register state saved on the kernel stack at every trap.
+ */
+struct trapframe {
+    ExceptionInfo info;
+    gregset_t gregs;
+    struct _libc_fpstate fp;
+};
+
+struct tlb_entry {
+    int used;
+    unsigned int vpn;
+    unsigned int pfn;
+    unsigned char kprot;
+    unsigned char uprot;
+};
+
+struct sim_context {
+    ucontext_t uc;
+};
+
+struct tty_event {
+    unsigned long tick;
+    int tty;
+    char *text;
+    struct tty_event *next;
+};
+
+struct replay_event {
+    int vector;
+    int code;
+    unsigned long entries;      /* Kernel entries, counting this one */
+};
+
+struct sim_stats {
+    unsigned long traps[TRAP_VECTOR_SIZE];
+    unsigned long tlb_misses;
+    unsigned long tlb_hits;
+    unsigned long tlb_evictions;
+    unsigned long flush_all;
+    unsigned long flush_region;
+    unsigned long flush_page;
+    unsigned long ptr0_writes;
+    unsigned long switches;
+    unsigned long disk_ops;
+    unsigned long disk_seek;
+    unsigned long replay_exact;
+    unsigned long replay_late;
+    unsigned long replay_early;
+    unsigned long replay_dropped;
+};
+
+static const int reg_map[NUM_REGS] = {
+    REG_RAX, REG_RDI, REG_RSI, REG_RDX, REG_RCX, REG_R8, REG_R9, REG_R10
+};
+
+/* Machine state */
+static int pmem_fd;
+static char *pmem;
+static unsigned int pmem_size = 8 * 1024 * 1024;
+static void (**vector_base)(ExceptionInfo *);
+static RCS421RegVal reg_ptr0;
+static RCS421RegVal reg_ptr1;
+static int vm_enabled;
+static volatile int mode = MODE_KERNEL;
+static volatile unsigned int pending;
+
+static struct tlb_entry tlb[TLB_MAX];
+static int tlb_size = 64;
+static int tlb_next;
+static short tlb_slot[NUM_VPN];
+
+static struct trapframe staging;
+static struct trapframe *ret_tf;
+static gregset_t template_gregs;
+static struct _libc_fpstate template_fp;
+
+static ucontext_t sw_uc, sw_ret;
+static SwitchFunc_t *sw_func;
+static SavedContext *sw_ctxp;
+static void *sw_p1, *sw_p2;
+static char *sw_stack;
+
+static struct sim_stats stats;
+static unsigned long ticks;
+static long tick_us = 10000;
+static unsigned long entries;
+
+/* Interrupt replay */
+static struct replay_event *replay;
+static int replay_len;
+static int replay_next;
+static int replaying;
+static volatile int stalled;
+static unsigned long alarm_entries;
+
+/* Tracing */
+static FILE *trace_fp;
+static int trace_kernel = -1;
+static int trace_user = -1;
+
+/* Terminals */
+static int tty_out[NUM_TERMINALS] = {-1, -1, -1, -1};
+static char *tty_in[NUM_TERMINALS];
+static int tty_in_len[NUM_TERMINALS];
+static struct tty_event *tty_script;
+
+/* Disk */
+#ifdef _LAB3
+static int disk_fd = -1;
+static int disk_busy;
+static int disk_head;
+static struct timespec disk_due;
+static long disk_base_us = 200;
+static long disk_track_us = 2;
+#endif
+
+static void fatal(const char *fmt, ...) __attribute__((noreturn));
+
+static void
+fatal(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "hostsim: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    _exit(2);
+}
+
+/*
+ *  ------------------------------------------------------------------
+ *  Memory and TLB
+ *  ------------------------------------------------------------------
+ */
+
+static void
+host_map(unsigned int vpn, unsigned int pfn, int prot)
+{
+    int hprot = prot;
+
+    if (pfn >= pmem_size / PAGESIZE)
+        fatal("pfn %u beyond physical memory (vpn %u)", pfn, vpn);
+
+    if (hprot & (PROT_WRITE | PROT_EXEC))
+        hprot |= PROT_READ;
+
+    if (mmap((void *)((unsigned long)vpn << PAGESHIFT), PAGESIZE, hprot,
+        MAP_SHARED | MAP_FIXED, pmem_fd, (off_t)pfn << PAGESHIFT) == MAP_FAILED)
+        fatal("mmap vpn %u: %s", vpn, strerror(errno));
+}
+
+static void
+host_unmap(unsigned int vpn)
+{
+    if (mmap((void *)((unsigned long)vpn << PAGESHIFT), PAGESIZE, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0)
+        == MAP_FAILED)
+        fatal("unmap vpn %u: %s", vpn, strerror(errno));
+}
+
+static void
+host_unmap_all(void)
+{
+    if (mmap((void *)SIM_LO, SIM_LEN, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0)
+        == MAP_FAILED)
+        fatal("unmap simulated memory: %s", strerror(errno));
+}
+
+/*
+ *  Translates a page table register value into a host pointer.  The
+ *  kernel hands REG_PTR0 a physical address; REG_PTR1 usually holds
+ *  the host address of kernel_page_table.
+ */
+static struct pte *
+table_ptr(RCS421RegVal reg)
+{
+    if (reg + PAGE_TABLE_SIZE <= pmem_size)
+        return (struct pte *)(pmem + reg);
+    return (struct pte *)reg;
+}
+
+static struct pte *
+walk(unsigned int vpn)
+{
+    if (vpn < PAGE_TABLE_LEN)
+        return reg_ptr0 ? table_ptr(reg_ptr0) + vpn : NULL;
+    return reg_ptr1 ? table_ptr(reg_ptr1) + (vpn - PAGE_TABLE_LEN) : NULL;
+}
+
+/*
+ *  Drops a TLB entry.  The entry is forgotten before its host mapping
+ *  is removed: the kernel calls WriteRegister on its own stack, so the
+ *  unmap may fault straight back in, and that fault must re-walk the
+ *  page tables rather than hit the entry being dropped.
+ */
+static void
+tlb_drop(int slot)
+{
+    unsigned int vpn = tlb[slot].vpn;
+
+    tlb_slot[vpn] = -1;
+    tlb[slot].used = 0;
+    host_unmap(vpn);
+}
+
+static int
+tlb_insert(unsigned int vpn, struct pte pte)
+{
+    int slot = tlb_next;
+
+    tlb_next = (tlb_next + 1) % tlb_size;
+    if (tlb[slot].used) {
+        tlb_drop(slot);
+        ++stats.tlb_evictions;
+    }
+
+    tlb[slot] = (struct tlb_entry) {
+        .used = 1,
+        .vpn = vpn,
+        .pfn = pte.pfn,
+        .kprot = pte.kprot,
+        .uprot = pte.uprot
+    };
+    tlb_slot[vpn] = slot;
+
+    return slot;
+}
+
+static void
+tlb_flush(RCS421RegVal what)
+{
+    int i;
+
+    if (what == TLB_FLUSH_ALL || what == TLB_FLUSH_0 || what == TLB_FLUSH_1) {
+        if (what == TLB_FLUSH_ALL)
+            ++stats.flush_all;
+        else
+            ++stats.flush_region;
+
+        for (i = 0; i < tlb_size; ++i) {
+            if (!tlb[i].used)
+                continue;
+            if (what == TLB_FLUSH_0 && tlb[i].vpn >= PAGE_TABLE_LEN)
+                continue;
+            if (what == TLB_FLUSH_1 && tlb[i].vpn < PAGE_TABLE_LEN)
+                continue;
+            tlb_drop(i);
+        }
+        return;
+    }
+
+    ++stats.flush_page;
+    if (what < VMEM_LIMIT && tlb_slot[what >> PAGESHIFT] >= 0)
+        tlb_drop(tlb_slot[what >> PAGESHIFT]);
+}
+
+/*
+ *  Resolves an access to a simulated virtual page.  Returns 0 if the
+ *  page is now mapped, or a TRAP_MEMORY code.
+ */
+static int
+tlb_fault(unsigned int vpn, int access)
+{
+    int slot;
+    int prot;
+
+    if (vpn < MEM_INVALID_PAGES)
+        return TRAP_MEMORY_MAPERR;
+
+    if (!vm_enabled) {
+        host_map(vpn, vpn, PROT_ALL);
+        return 0;
+    }
+
+    if ((slot = tlb_slot[vpn]) < 0) {
+        struct pte *pte = walk(vpn);
+
+        if (pte == NULL || !pte->valid)
+            return TRAP_MEMORY_MAPERR;
+
+        slot = tlb_insert(vpn, *pte);
+        ++stats.tlb_misses;
+    } else
+        ++stats.tlb_hits;
+
+    prot = (mode == MODE_KERNEL) ? tlb[slot].kprot : tlb[slot].uprot;
+    if ((prot & access) != access)
+        return TRAP_MEMORY_ACCERR;
+
+    host_map(vpn, tlb[slot].pfn, prot);
+    return 0;
+}
+
+/*
+ *  Changes the processor mode.  Cached translations stay in the TLB
+ *  model, but their host mappings are revoked so the next access is
+ *  checked against the protection for the new mode.
+ */
+static void
+set_mode(int m)
+{
+    if (mode == m)
+        return;
+    mode = m;
+    if (vm_enabled && mprotect((void *)SIM_LO, SIM_LEN, PROT_NONE) < 0)
+        fatal("mprotect: %s", strerror(errno));
+}
+
+/*
+ *  Touches [addr, addr + len) in kernel mode so that host system calls
+ *  made on behalf of the kernel see mapped memory.
+ */
+static void
+prefault(void *addr, size_t len, int access)
+{
+    unsigned long a = DOWN_TO_PAGE(addr);
+    unsigned long end = (unsigned long)addr + len;
+
+    for (; a < end && a < VMEM_LIMIT; a += PAGESIZE) {
+        if (tlb_fault(a >> PAGESHIFT, access) != 0)
+            fatal("kernel access to unmapped address %p", (void *)a);
+    }
+}
+
+/*
+ *  ------------------------------------------------------------------
+ *  Interrupts and events
+ *  ------------------------------------------------------------------
+ */
+
+static long
+us_until(struct timespec *t)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (t->tv_sec - now.tv_sec) * 1000000L +
+        (t->tv_nsec - now.tv_nsec) / 1000;
+}
+
+static void
+poll_events(void)
+{
+#ifdef _LAB3
+    if (disk_busy && us_until(&disk_due) <= 0) {
+        disk_busy = 0;
+        pending |= PEND_DISK;
+    }
+#endif
+}
+
+static void
+clock_tick(void)
+{
+    struct tty_event *ev;
+
+    /*
+     *  While replaying, the timer only watches for a machine that has
+     *  stopped entering the kernel, such as a user loop that relied on
+     *  being preempted.
+     */
+    if (replaying) {
+        if (entries == alarm_entries)
+            stalled = 1;
+        alarm_entries = entries;
+        return;
+    }
+
+    ++ticks;
+    pending |= PEND_CLOCK;
+
+    while ((ev = tty_script) != NULL && ev->tick <= ticks) {
+        int len = strlen(ev->text);
+
+        tty_script = ev->next;
+        tty_in[ev->tty] = realloc(tty_in[ev->tty], tty_in_len[ev->tty] + len);
+        memcpy(tty_in[ev->tty] + tty_in_len[ev->tty], ev->text, len);
+        tty_in_len[ev->tty] += len;
+        pending |= PEND_RECEIVE(ev->tty);
+        free(ev->text);
+        free(ev);
+    }
+}
+
+/*
+ *  Makes a replayed interrupt's device ready to raise it, if it can
+ *  be.  A receive takes the terminal's next scripted line whatever
+ *  tick it was scripted for; a transmit or disk transfer must have
+ *  been started, but is done as soon as the schedule says so.
+ */
+static int
+replay_ready(struct replay_event *ev)
+{
+    struct tty_event **evp, *tev;
+    int t = ev->code;
+
+    switch (ev->vector) {
+    case TRAP_CLOCK:
+        return 1;
+    case TRAP_TTY_RECEIVE:
+        if (t < 0 || t >= NUM_TERMINALS)
+            return 0;
+        for (evp = &tty_script; tty_in_len[t] == 0 && *evp != NULL;
+            evp = &(*evp)->next) {
+            if ((tev = *evp)->tty != t)
+                continue;
+            *evp = tev->next;
+            tty_in_len[t] = strlen(tev->text);
+            tty_in[t] = realloc(tty_in[t], tty_in_len[t]);
+            memcpy(tty_in[t], tev->text, tty_in_len[t]);
+            free(tev->text);
+            free(tev);
+            break;
+        }
+        return tty_in_len[t] > 0;
+    case TRAP_TTY_TRANSMIT:
+        return t >= 0 && t < NUM_TERMINALS && (pending & PEND_TRANSMIT(t));
+#ifdef _LAB3
+    case TRAP_DISK:
+        return disk_busy;
+#endif
+    }
+    return 0;
+}
+
+/*
+ *  Takes the next interrupt from the replay schedule, returning its
+ *  vector number (and code), or -1 if it is not due yet.
+ *
+ *  An interrupt is due once as many kernel entries have been made as
+ *  when it was recorded, and is delivered as soon as its device is
+ *  ready.  A machine that is idle or stalled takes the next one at
+ *  once, or drops it if its device is not ready, since nothing else
+ *  will move it on; replaying on the kernel that recorded the schedule
+ *  should not need to.  When the schedule runs out, the timer and
+ *  devices take over again.
+ */
+static int
+take_replay(int *code)
+{
+    struct replay_event *ev;
+
+    while (replay_next < replay_len) {
+        ev = &replay[replay_next];
+        if (entries + 1 < ev->entries && !stalled)
+            return -1;
+        if (!replay_ready(ev)) {
+            if (!stalled)
+                return -1;
+            ++stats.replay_dropped;
+            ++replay_next;
+            continue;
+        }
+
+        ++replay_next;
+        stalled = 0;
+        if (entries + 1 == ev->entries)
+            ++stats.replay_exact;
+        else if (entries + 1 > ev->entries)
+            ++stats.replay_late;
+        else
+            ++stats.replay_early;
+
+        switch (ev->vector) {
+        case TRAP_CLOCK:
+            ++ticks;
+            break;
+        case TRAP_TTY_TRANSMIT:
+            pending &= ~PEND_TRANSMIT(ev->code);
+            break;
+#ifdef _LAB3
+        case TRAP_DISK:
+            disk_busy = 0;
+            break;
+#endif
+        }
+
+        *code = ev->code;
+        return ev->vector;
+    }
+
+    replaying = 0;
+    return -1;
+}
+
+/*
+ *  Removes the highest priority pending interrupt, returning its
+ *  vector number (and code), or -1 if nothing is pending.
+ */
+static int
+take_pending(int *code)
+{
+    int t;
+
+    if (replaying)
+        return take_replay(code);
+
+    poll_events();
+
+    if (pending & PEND_CLOCK) {
+        pending &= ~PEND_CLOCK;
+        *code = 0;
+        return TRAP_CLOCK;
+    }
+    for (t = 0; t < NUM_TERMINALS; ++t) {
+        if (pending & PEND_RECEIVE(t)) {
+            pending &= ~PEND_RECEIVE(t);
+            *code = t;
+            return TRAP_TTY_RECEIVE;
+        }
+    }
+    for (t = 0; t < NUM_TERMINALS; ++t) {
+        if (pending & PEND_TRANSMIT(t)) {
+            pending &= ~PEND_TRANSMIT(t);
+            *code = t;
+            return TRAP_TTY_TRANSMIT;
+        }
+    }
+#ifdef _LAB3
+    if (pending & PEND_DISK) {
+        pending &= ~PEND_DISK;
+        *code = 0;
+        return TRAP_DISK;
+    }
+#endif
+    return -1;
+}
+
+/*
+ *  ------------------------------------------------------------------
+ *  Kernel entry and exit
+ *  ------------------------------------------------------------------
+ */
+
+static void __attribute__((noreturn))
+call_on_stack(unsigned long sp, void (*fn)(void))
+{
+    __asm__ volatile(
+        "mov %0, %%rsp\n\t"
+        "xor %%ebp, %%ebp\n\t"
+        "call *%1\n\t"
+        "ud2"
+        : : "r"(sp), "r"(fn) : "memory");
+    __builtin_unreachable();
+}
+
+static void
+dispatch(ExceptionInfo *info)
+{
+    void (*handler)(ExceptionInfo *);
+
+    if (info->vector < 0 || info->vector >= TRAP_VECTOR_SIZE)
+        fatal("bad vector %d", info->vector);
+    if (vector_base == NULL || (handler = vector_base[info->vector]) == NULL)
+        fatal("no handler for vector %d", info->vector);
+
+    ++stats.traps[info->vector];
+    ++entries;
+    handler(info);
+}
+
+/*
+ *  Runs on the Region 0 kernel stack.  Copies the staged trap frame
+ *  onto the stack, calls the handler, delivers anything that became
+ *  pending meanwhile and then returns to user mode.
+ */
+static void __attribute__((noreturn))
+return_to_user(struct trapframe *tf)
+{
+    sigset_t set;
+    int v, code;
+
+    for (;;) {
+        sigemptyset(&set);
+        sigaddset(&set, SIGALRM);
+        sigprocmask(SIG_BLOCK, &set, NULL);
+
+        if ((v = take_pending(&code)) < 0)
+            break;
+
+        sigprocmask(SIG_UNBLOCK, &set, NULL);
+        tf->info.vector = v;
+        tf->info.code = code;
+        tf->info.addr = NULL;
+        dispatch(&tf->info);
+    }
+
+    ret_tf = tf;
+    raise(SIGUSR2);
+    fatal("returned from user mode exit");
+}
+
+static void __attribute__((noreturn))
+kernel_entry(void)
+{
+    struct trapframe tf;
+
+    memcpy(&tf, &staging, sizeof(tf));
+    dispatch(&tf.info);
+    return_to_user(&tf);
+}
+
+/*
+ *  Called from a signal handler that interrupted user mode.  Abandons
+ *  the signal frame and continues on the kernel stack.
+ */
+static void __attribute__((noreturn))
+enter_kernel(ucontext_t *uc, int vector, int code, void *addr)
+{
+    sigset_t none;
+    int i;
+
+    staging.info = (ExceptionInfo) {
+        .vector = vector,
+        .code = code,
+        .addr = addr,
+        .psr = 0,
+        .pc = (void *)uc->uc_mcontext.gregs[REG_RIP],
+        .sp = (void *)uc->uc_mcontext.gregs[REG_RSP]
+    };
+    for (i = 0; i < NUM_REGS; ++i)
+        staging.info.regs[i] = uc->uc_mcontext.gregs[reg_map[i]];
+    memcpy(staging.gregs, uc->uc_mcontext.gregs, sizeof(gregset_t));
+    memcpy(&staging.fp, uc->uc_mcontext.fpregs, sizeof(staging.fp));
+
+    set_mode(MODE_KERNEL);
+
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+    call_on_stack(KERNEL_STACK_LIMIT, kernel_entry);
+}
+
+static void
+deliver_pending(ucontext_t *uc)
+{
+    int v, code;
+
+    if ((v = take_pending(&code)) >= 0)
+        enter_kernel(uc, v, code, NULL);
+}
+
+static void
+on_usr2(int sig, siginfo_t *si, void *ctx)
+{
+    ucontext_t *uc = ctx;
+    struct trapframe *tf = ret_tf;
+    int i;
+
+    greg_t csgsfs = uc->uc_mcontext.gregs[REG_CSGSFS];
+    greg_t efl = uc->uc_mcontext.gregs[REG_EFL];
+
+    /*
+     *  getcontext does not record segment selectors or flags, so the
+     *  boot-time template leaves them zero; keep the live values.
+     */
+    memcpy(uc->uc_mcontext.gregs, tf->gregs, sizeof(gregset_t));
+    uc->uc_mcontext.gregs[REG_CSGSFS] = csgsfs;
+    if (uc->uc_mcontext.gregs[REG_EFL] == 0)
+        uc->uc_mcontext.gregs[REG_EFL] = efl;
+    uc->uc_mcontext.gregs[REG_RIP] = (greg_t)tf->info.pc;
+    uc->uc_mcontext.gregs[REG_RSP] = (greg_t)tf->info.sp;
+    for (i = 0; i < NUM_REGS; ++i)
+        uc->uc_mcontext.gregs[reg_map[i]] = tf->info.regs[i];
+    memcpy(uc->uc_mcontext.fpregs, &tf->fp, sizeof(tf->fp));
+    sigemptyset(&uc->uc_sigmask);
+
+    set_mode(MODE_USER);
+}
+
+/*
+ *  ------------------------------------------------------------------
+ *  Services the stand-in performs for user programs directly
+ *  ------------------------------------------------------------------
+ */
+
+static void
+user_trace(ucontext_t *uc)
+{
+    int level = (int)uc->uc_mcontext.gregs[REG_RDI];
+    char *buf = (char *)uc->uc_mcontext.gregs[REG_RSI];
+    int len = (int)uc->uc_mcontext.gregs[REG_RDX];
+
+    if (level <= trace_user && trace_fp != NULL) {
+        fwrite(buf, 1, len, trace_fp);
+        fflush(trace_fp);
+    }
+}
+
+static void
+user_pause(ucontext_t *uc)
+{
+    sigset_t set;
+    struct timespec ts;
+    int v, code;
+
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+
+    if (replaying)
+        stalled = 1;
+
+    while ((v = take_pending(&code)) < 0) {
+        long wait = tick_us;
+
+#ifdef _LAB3
+        if (disk_busy) {
+            long d = us_until(&disk_due);
+            if (d < wait)
+                wait = d > 0 ? d : 0;
+        }
+#endif
+        ts.tv_sec = wait / 1000000;
+        ts.tv_nsec = (wait % 1000000) * 1000;
+        if (sigtimedwait(&set, NULL, &ts) == SIGALRM)
+            clock_tick();
+    }
+
+    enter_kernel(uc, v, code, NULL);
+}
+
+/*
+ *  ------------------------------------------------------------------
+ *  Signal handlers
+ *  ------------------------------------------------------------------
+ */
+
+static void
+on_segv(int sig, siginfo_t *si, void *ctx)
+{
+    ucontext_t *uc = ctx;
+    unsigned long addr = (unsigned long)si->si_addr;
+    unsigned long err = uc->uc_mcontext.gregs[REG_ERR];
+    int access = (err & 0x10) ? PROT_EXEC : (err & 0x2) ? PROT_WRITE : PROT_READ;
+    int code = TRAP_MEMORY_MAPERR;
+
+    if (addr < VMEM_LIMIT) {
+        if ((code = tlb_fault(addr >> PAGESHIFT, access)) == 0)
+            return;
+    }
+
+    if (mode == MODE_KERNEL)
+        fatal("kernel %s fault at %p, pc %p",
+            access == PROT_WRITE ? "write" : "read", (void *)addr,
+            (void *)uc->uc_mcontext.gregs[REG_RIP]);
+
+    enter_kernel(uc, TRAP_MEMORY, code, (void *)addr);
+}
+
+static void
+on_ill(int sig, siginfo_t *si, void *ctx)
+{
+    ucontext_t *uc = ctx;
+    unsigned char *pc = (unsigned char *)uc->uc_mcontext.gregs[REG_RIP];
+    long call;
+
+    if (mode == MODE_KERNEL)
+        fatal("illegal instruction in kernel at %p", (void *)pc);
+
+    if (pc[0] != 0x0f || pc[1] != 0x0b) {
+        enter_kernel(uc, TRAP_ILLEGAL, sig == SIGBUS ?
+            TRAP_ILLEGAL_ADRERR : TRAP_ILLEGAL_ILLOPC, si->si_addr);
+    }
+
+    uc->uc_mcontext.gregs[REG_RIP] += 2;
+    call = uc->uc_mcontext.gregs[REG_RAX];
+
+    switch (call) {
+    case SIM_CALL_TRACE:
+        user_trace(uc);
+        deliver_pending(uc);
+        return;
+    case SIM_CALL_PAUSE:
+        user_pause(uc);
+        return;
+    default:
+        enter_kernel(uc, TRAP_KERNEL, (int)call, NULL);
+    }
+}
+
+static void
+on_fpe(int sig, siginfo_t *si, void *ctx)
+{
+    if (mode == MODE_KERNEL)
+        fatal("arithmetic exception in kernel at %p", si->si_addr);
+    enter_kernel(ctx, TRAP_MATH, si->si_code, si->si_addr);
+}
+
+static void
+on_alrm(int sig, siginfo_t *si, void *ctx)
+{
+    clock_tick();
+    if (mode == MODE_USER)
+        deliver_pending(ctx);
+}
+
+/*
+ *  ------------------------------------------------------------------
+ *  hardware.h interface
+ *  ------------------------------------------------------------------
+ */
+
+void
+WriteRegister(int reg, RCS421RegVal val)
+{
+    switch (reg) {
+    case REG_VECTOR_BASE:
+        vector_base = (void (**)(ExceptionInfo *))val;
+        break;
+    case REG_PTR0:
+        reg_ptr0 = val;
+        ++stats.ptr0_writes;
+        break;
+    case REG_PTR1:
+        reg_ptr1 = val;
+        break;
+    case REG_VM_ENABLE:
+        if (val && !vm_enabled) {
+            /*
+             *  Set the flag first: returning from host_unmap_all touches
+             *  the kernel stack, and that fault must go through the
+             *  page tables rather than re-establish a physical mapping.
+             */
+            vm_enabled = 1;
+            host_unmap_all();
+        }
+        break;
+    case REG_TLB_FLUSH:
+        tlb_flush(val);
+        break;
+    default:
+        fatal("WriteRegister: bad register %d", reg);
+    }
+}
+
+RCS421RegVal
+ReadRegister(int reg)
+{
+    switch (reg) {
+    case REG_VECTOR_BASE:
+        return (RCS421RegVal)vector_base;
+    case REG_PTR0:
+        return reg_ptr0;
+    case REG_PTR1:
+        return reg_ptr1;
+    case REG_VM_ENABLE:
+        return vm_enabled;
+    }
+    fatal("ReadRegister: bad register %d", reg);
+}
+
+void
+TtyTransmit(int tty, void *buf, int len)
+{
+    char out[TERMINAL_MAX_LINE];
+
+    if (tty < 0 || tty >= NUM_TERMINALS || len < 0 || len > TERMINAL_MAX_LINE)
+        fatal("TtyTransmit: bad arguments (%d, %p, %d)", tty, buf, len);
+
+    memcpy(out, buf, len);
+    if (write(tty_out[tty], out, len) < 0)
+        fatal("TtyTransmit: %s", strerror(errno));
+    if (tty == TTY_CONSOLE && write(STDOUT_FILENO, out, len) < 0)
+        fatal("TtyTransmit: %s", strerror(errno));
+
+    pending |= PEND_TRANSMIT(tty);
+}
+
+int
+TtyReceive(int tty, void *buf, int len)
+{
+    char *nl;
+    int n;
+
+    if (tty < 0 || tty >= NUM_TERMINALS)
+        fatal("TtyReceive: bad terminal %d", tty);
+
+    if (tty_in_len[tty] == 0)
+        return 0;
+
+    nl = memchr(tty_in[tty], '\n', tty_in_len[tty]);
+    n = nl ? nl - tty_in[tty] + 1 : tty_in_len[tty];
+    if (n > len)
+        n = len;
+
+    memcpy(buf, tty_in[tty], n);
+    memmove(tty_in[tty], tty_in[tty] + n, tty_in_len[tty] - n);
+    tty_in_len[tty] -= n;
+
+    if (tty_in_len[tty] > 0)
+        pending |= PEND_RECEIVE(tty);
+
+    return n;
+}
+
+#ifdef _LAB3
+void
+DiskAccess(int op, int sector, void *buf)
+{
+    char sec[SECTORSIZE];
+    long us;
+
+    if (disk_busy)
+        fatal("DiskAccess while disk busy");
+    if (sector < 0 || sector >= NUMSECTORS)
+        fatal("DiskAccess: bad sector %d", sector);
+
+    if (op == DISK_READ) {
+        if (pread(disk_fd, sec, SECTORSIZE, (off_t)sector * SECTORSIZE) < 0)
+            fatal("disk read: %s", strerror(errno));
+        memcpy(buf, sec, SECTORSIZE);
+    } else if (op == DISK_WRITE) {
+        memcpy(sec, buf, SECTORSIZE);
+        if (pwrite(disk_fd, sec, SECTORSIZE, (off_t)sector * SECTORSIZE) < 0)
+            fatal("disk write: %s", strerror(errno));
+    } else
+        fatal("DiskAccess: bad op %d", op);
+
+    ++stats.disk_ops;
+    stats.disk_seek += abs(sector - disk_head);
+    us = disk_base_us + disk_track_us * abs(sector - disk_head);
+    disk_head = sector;
+
+    clock_gettime(CLOCK_MONOTONIC, &disk_due);
+    disk_due.tv_nsec += us * 1000;
+    disk_due.tv_sec += disk_due.tv_nsec / 1000000000;
+    disk_due.tv_nsec %= 1000000000;
+    disk_busy = 1;
+}
+#endif
+
+static void
+print_stats(void)
+{
+    int i;
+
+    fprintf(stderr, "hostsim: %lu ticks, %lu context switches\n",
+        ticks, stats.switches);
+    fprintf(stderr, "hostsim: traps:");
+    for (i = 0; i < TRAP_VECTOR_SIZE; ++i) {
+        if (stats.traps[i])
+            fprintf(stderr, " [%d]=%lu", i, stats.traps[i]);
+    }
+    fprintf(stderr, "\n");
+    fprintf(stderr, "hostsim: tlb: %lu misses, %lu hits after mode switch, "
+        "%lu evictions (capacity %d)\n", stats.tlb_misses, stats.tlb_hits,
+        stats.tlb_evictions, tlb_size);
+    fprintf(stderr, "hostsim: tlb flushes: %lu all, %lu region, %lu page; "
+        "%lu REG_PTR0 writes\n", stats.flush_all, stats.flush_region,
+        stats.flush_page, stats.ptr0_writes);
+#ifdef _LAB3
+    fprintf(stderr, "hostsim: disk: %lu operations, %lu sectors of seek\n",
+        stats.disk_ops, stats.disk_seek);
+#endif
+    if (replay_len > 0)
+        fprintf(stderr, "hostsim: replay: %d of %d interrupts, %lu on "
+            "schedule, %lu late, %lu early, %lu dropped\n", replay_next,
+            replay_len, stats.replay_exact, stats.replay_late,
+            stats.replay_early, stats.replay_dropped);
+}
+
+void
+Halt(void)
+{
+    struct itimerval off = {{0, 0}, {0, 0}};
+
+    setitimer(ITIMER_REAL, &off, NULL);
+    if (trace_fp != NULL)
+        fflush(trace_fp);
+    print_stats();
+    _exit(0);
+}
+
+void
+Pause(void)
+{
+    fatal("Pause called in kernel mode");
+}
+
+void
+VTracePrintf(int level, char *fmt, va_list ap)
+{
+    if (level <= trace_kernel && trace_fp != NULL) {
+        vfprintf(trace_fp, fmt, ap);
+        fflush(trace_fp);
+    }
+}
+
+void
+TracePrintf(int level, char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    VTracePrintf(level, fmt, ap);
+    va_end(ap);
+}
+
+static void
+switch_trampoline(void)
+{
+    SavedContext *next = sw_func(sw_ctxp, sw_p1, sw_p2);
+
+    if (next == sw_ctxp)
+        setcontext(&sw_ret);
+
+    ++stats.switches;
+    setcontext(&((struct sim_context *)next)->uc);
+    fatal("setcontext failed");
+}
+
+int
+ContextSwitch(SwitchFunc_t *func, SavedContext *ctxp, void *p1, void *p2)
+{
+    volatile int resumed = 0;
+
+    getcontext(&((struct sim_context *)ctxp)->uc);
+    if (resumed)
+        return 0;
+    resumed = 1;
+
+    sw_func = func;
+    sw_ctxp = ctxp;
+    sw_p1 = p1;
+    sw_p2 = p2;
+
+    getcontext(&sw_uc);
+    sw_uc.uc_stack.ss_sp = sw_stack;
+    sw_uc.uc_stack.ss_size = SWSTACK_SIZE;
+    sw_uc.uc_link = NULL;
+    makecontext(&sw_uc, switch_trampoline, 0);
+
+    swapcontext(&sw_ret, &sw_uc);
+    return 0;
+}
+
+/*
+ *  The kernel reads program images straight into Region 0.  Touch the
+ *  destination first so the host read() does not fail with EFAULT.
+ */
+ssize_t
+read(int fd, void *buf, size_t count)
+{
+    size_t done = 0;
+
+    while (done < count) {
+        char *p = (char *)buf + done;
+        size_t n = count - done;
+        ssize_t r;
+
+        if ((unsigned long)p < VMEM_LIMIT) {
+            if (n > PAGESIZE - ((unsigned long)p & PAGEOFFSET))
+                n = PAGESIZE - ((unsigned long)p & PAGEOFFSET);
+            prefault(p, n, PROT_WRITE);
+        }
+
+        if ((r = syscall(SYS_read, fd, p, n)) < 0)
+            return done ? (ssize_t)done : r;
+        if (r == 0)
+            break;
+        done += r;
+    }
+    return done;
+}
+
+/*
+ *  Exec hands open() a file name that is still in Region 0, which may
+ *  not be in the TLB.  Touch it first for the same reason.
+ */
+int
+open(const char *path, int flags, ...)
+{
+    volatile const char *p = path;
+    mode_t mode = 0;
+    va_list ap;
+
+    if (flags & O_CREAT) {
+        va_start(ap, flags);
+        mode = va_arg(ap, mode_t);
+        va_end(ap);
+    }
+
+    if ((unsigned long)path < VMEM_LIMIT)
+        while (*p != '\0')
+            ++p;
+
+    return syscall(SYS_openat, AT_FDCWD, path, flags, mode);
+}
+
+/*
+ *  ------------------------------------------------------------------
+ *  Boot
+ *  ------------------------------------------------------------------
+ */
+
+static char **boot_args;
+
+static void __attribute__((noreturn))
+boot_entry(void)
+{
+    struct trapframe tf;
+
+    memset(&tf, 0, sizeof(tf));
+    memcpy(tf.gregs, template_gregs, sizeof(gregset_t));
+    memcpy(&tf.fp, &template_fp, sizeof(tf.fp));
+
+    KernelStart(&tf.info, pmem_size,
+        (void *)(VMEM_1_BASE +
+            (SIM_KERNEL_TEXT_PAGES + SIM_KERNEL_HEAP_PAGES) * PAGESIZE),
+        boot_args);
+
+    if (!vm_enabled)
+        fatal("KernelStart returned without enabling virtual memory");
+
+    return_to_user(&tf);
+}
+
+static void
+load_tty_script(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    struct tty_event **tail = &tty_script;
+    char line[TERMINAL_MAX_LINE + 64];
+
+    if (fp == NULL)
+        fatal("%s: %s", path, strerror(errno));
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        struct tty_event *ev;
+        unsigned long tick;
+        int tty, off;
+
+        if (line[0] == '#' || sscanf(line, "%lu %d %n", &tick, &tty, &off) < 2)
+            continue;
+        if (tty < 0 || tty >= NUM_TERMINALS)
+            fatal("%s: bad terminal %d", path, tty);
+
+        ev = malloc(sizeof(*ev));
+        *ev = (struct tty_event) {
+            .tick = tick,
+            .tty = tty,
+            .text = strdup(line + off),
+            .next = NULL
+        };
+        *tail = ev;
+        tail = &ev->next;
+    }
+    fclose(fp);
+}
+
+/*
+ *  Reads the REPLAY lines the kernel wrote to a TRACE file: vector,
+ *  code, clock_count and kernel entries for each interrupt.
+ */
+static void
+load_replay(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    char line[1024], *p;
+    struct replay_event ev;
+    unsigned long tick;
+    int size = 0;
+
+    if (fp == NULL)
+        fatal("%s: %s", path, strerror(errno));
+
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if ((p = strstr(line, "REPLAY:")) == NULL ||
+            sscanf(p, "REPLAY: %d %d %lu %lu", &ev.vector, &ev.code, &tick,
+            &ev.entries) != 4)
+            continue;
+
+        if (replay_len == size) {
+            size = size ? 2 * size : 1024;
+            replay = realloc(replay, size * sizeof(*replay));
+        }
+        replay[replay_len++] = ev;
+    }
+    fclose(fp);
+
+    if (replay_len == 0)
+        fatal("%s: no REPLAY records", path);
+    replaying = 1;
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: yalnix [-t tracefile] [-lk level] [-lu level] "
+        "[-n] [-s] [-i ttyscript] [-r replaytrace] [-T tick_us] [-M pmem_kb] "
+        "[-tlb entries] initprog [args...]\n");
+    exit(1);
+}
+
+static void
+install(int sig, void (*fn)(int, siginfo_t *, void *))
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = fn;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    sigaddset(&sa.sa_mask, SIGALRM);
+    if (sigaction(sig, &sa, NULL) < 0)
+        fatal("sigaction: %s", strerror(errno));
+}
+
+int
+main(int argc, char **argv)
+{
+    static char *init_default[] = {"init", NULL};
+    char *trace_file = "TRACE";
+    stack_t ss;
+    ucontext_t here;
+    struct itimerval it;
+    char name[32];
+    int i;
+
+    for (i = 1; i < argc && argv[i][0] == '-'; ++i) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+            trace_file = argv[++i];
+        else if (strcmp(argv[i], "-lk") == 0 && i + 1 < argc)
+            trace_kernel = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-lu") == 0 && i + 1 < argc)
+            trace_user = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+            load_tty_script(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+            load_replay(argv[++i]);
+        else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc)
+            tick_us = atol(argv[++i]);
+        else if (strcmp(argv[i], "-M") == 0 && i + 1 < argc)
+            pmem_size = atoi(argv[++i]) * 1024;
+        else if (strcmp(argv[i], "-tlb") == 0 && i + 1 < argc)
+            tlb_size = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-n") == 0 || strcmp(argv[i], "-s") == 0)
+            continue;
+        else
+            usage();
+    }
+    boot_args = (i < argc) ? &argv[i] : init_default;
+
+    if (pmem_size < VMEM_LIMIT || pmem_size % PAGESIZE != 0)
+        fatal("physical memory must be a page multiple of at least %d KB",
+            VMEM_LIMIT / 1024);
+    if (tlb_size < 1 || tlb_size > TLB_MAX)
+        fatal("TLB size must be between 1 and %d", TLB_MAX);
+    if (tick_us <= 0)
+        fatal("clock period must be positive");
+
+    if (trace_kernel >= 0 || trace_user >= 0) {
+        if ((trace_fp = fopen(trace_file, "w")) == NULL)
+            fatal("%s: %s", trace_file, strerror(errno));
+    }
+
+    for (i = 0; i < NUM_TERMINALS; ++i) {
+        snprintf(name, sizeof(name), "TTYLOG.%d", i);
+        if ((tty_out[i] = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+            fatal("%s: %s", name, strerror(errno));
+    }
+
+#ifdef _LAB3
+    if ((disk_fd = open("DISK", O_RDWR | O_CREAT, 0644)) < 0)
+        fatal("DISK: %s", strerror(errno));
+    if (ftruncate(disk_fd, (off_t)NUMSECTORS * SECTORSIZE) < 0)
+        fatal("DISK: %s", strerror(errno));
+#endif
+
+    /* Physical memory and the simulated address range */
+    if ((pmem_fd = memfd_create("yalnix-pmem", 0)) < 0 ||
+        ftruncate(pmem_fd, pmem_size) < 0)
+        fatal("physical memory: %s", strerror(errno));
+    if ((pmem = mmap(NULL, pmem_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        pmem_fd, 0)) == MAP_FAILED)
+        fatal("physical memory: %s", strerror(errno));
+    if (mmap((void *)SIM_LO, SIM_LEN, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS |
+        MAP_FIXED_NOREPLACE | MAP_NORESERVE, -1, 0) != (void *)SIM_LO)
+        fatal("cannot reserve [%#x, %#x): %s", SIM_LO, VMEM_LIMIT,
+            strerror(errno));
+    memset(tlb_slot, -1, sizeof(tlb_slot));
+
+    /* Signal handling */
+    ss.ss_sp = malloc(ALTSTACK_SIZE);
+    ss.ss_size = ALTSTACK_SIZE;
+    ss.ss_flags = 0;
+    if (sigaltstack(&ss, NULL) < 0)
+        fatal("sigaltstack: %s", strerror(errno));
+    sw_stack = malloc(SWSTACK_SIZE);
+
+    install(SIGSEGV, on_segv);
+    install(SIGBUS, on_ill);
+    install(SIGILL, on_ill);
+    install(SIGFPE, on_fpe);
+    install(SIGALRM, on_alrm);
+    install(SIGUSR2, on_usr2);
+
+    /* Register state that user processes start from */
+    getcontext(&here);
+    memcpy(template_gregs, here.uc_mcontext.gregs, sizeof(gregset_t));
+    memcpy(&template_fp, here.uc_mcontext.fpregs, sizeof(template_fp));
+
+    it.it_interval.tv_sec = tick_us / 1000000;
+    it.it_interval.tv_usec = tick_us % 1000000;
+    it.it_value = it.it_interval;
+    setitimer(ITIMER_REAL, &it, NULL);
+
+    call_on_stack(KERNEL_STACK_LIMIT, boot_entry);
+}
@@ -0,0 +1,31 @@
+/*
+ *  Definitions shared by the host hardware stand-in and the user
+ *  library it loads Yalnix programs with.
+ */
+
+#ifndef _hostsim_h
+#define _hostsim_h
+
+/*
+ *  User programs enter the kernel by executing ud2 with the kernel
+ *  call number in rax and the arguments in rdi, rsi, rdx and rcx.
+ *  These map onto regs[0..4] of the ExceptionInfo handed to the
+ *  kernel; regs[0] (rax) carries the return value back.
+ *
+ *  Call numbers at or above SIM_CALL_BASE are serviced by the
+ *  stand-in itself and never reach the kernel.
+ */
+#define SIM_CALL_BASE       0x1000
+#define SIM_CALL_TRACE      (SIM_CALL_BASE + 0)     /* TracePrintf */
+#define SIM_CALL_PAUSE      (SIM_CALL_BASE + 1)     /* Pause */
+
+/*
+ *  Layout of the kernel image the stand-in pretends to have booted.
+ *  KernelStart maps [VMEM_1_BASE, _etext) as text and
+ *  [_etext, orig_brk) as heap.  The kernel's real code and malloc
+ *  heap live in host memory, so these frames are simply reserved.
+ */
+#define SIM_KERNEL_TEXT_PAGES   16
+#define SIM_KERNEL_HEAP_PAGES   16
+
+#endif /*!_hostsim_h*/
@@ -0,0 +1,26 @@
+/*
+ *  Host stand-in for the loader interface used by LoadProgram.
+ *
+ *  LoadInfo() reads the headers of the executable open on fd, fills
+ *  in *li, and leaves fd positioned so that the next read() returns
+ *  text_size + data_size bytes of program image starting at
+ *  MEM_INVALID_SIZE.
+ */
+
+#ifndef _loadinfo_h
+#define _loadinfo_h
+
+struct loadinfo {
+    unsigned long text_size;
+    unsigned long data_size;
+    unsigned long bss_size;
+    unsigned long entry;
+};
+
+#define LI_SUCCESS      0
+#define LI_FORMAT_ERROR 1
+#define LI_OTHER_ERROR  2
+
+extern int LoadInfo(int, struct loadinfo *);
+
+#endif /*!_loadinfo_h*/
@@ -0,0 +1,103 @@
+/*
+ *  LoadInfo for the host stand-in.
+ *
+ *  User programs are static ELF executables linked at MEM_INVALID_SIZE
+ *  with user.ld.  LoadInfo flattens their loadable segments into one
+ *  image starting at MEM_INVALID_SIZE and substitutes that image for
+ *  the file open on fd, so that LoadProgram's single read() of
+ *  text_size + data_size bytes lands everything in place.
+ */
+
+#define _GNU_SOURCE
+#include <elf.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <comp421/hardware.h>
+#include <comp421/loadinfo.h>
+
+int
+LoadInfo(int fd, struct loadinfo *li)
+{
+    Elf64_Ehdr eh;
+    Elf64_Phdr *ph;
+    unsigned long file_end = MEM_INVALID_SIZE;
+    unsigned long mem_end = MEM_INVALID_SIZE;
+    unsigned long data_start = 0;
+    char *image;
+    int img;
+    int i;
+
+    if (pread(fd, &eh, sizeof(eh), 0) != sizeof(eh) ||
+        memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0 ||
+        eh.e_ident[EI_CLASS] != ELFCLASS64 || eh.e_type != ET_EXEC ||
+        eh.e_phentsize != sizeof(Elf64_Phdr))
+        return LI_FORMAT_ERROR;
+
+    ph = malloc(eh.e_phnum * sizeof(Elf64_Phdr));
+    if (ph == NULL)
+        return LI_OTHER_ERROR;
+    if (pread(fd, ph, eh.e_phnum * sizeof(Elf64_Phdr), eh.e_phoff) !=
+        (ssize_t)(eh.e_phnum * sizeof(Elf64_Phdr))) {
+        free(ph);
+        return LI_FORMAT_ERROR;
+    }
+
+    for (i = 0; i < eh.e_phnum; ++i) {
+        if (ph[i].p_type != PT_LOAD)
+            continue;
+        if (ph[i].p_vaddr < MEM_INVALID_SIZE ||
+            ph[i].p_vaddr + ph[i].p_memsz > USER_STACK_LIMIT) {
+            free(ph);
+            return LI_FORMAT_ERROR;
+        }
+        if ((ph[i].p_flags & PF_W) && data_start == 0)
+            data_start = DOWN_TO_PAGE(ph[i].p_vaddr);
+        if (ph[i].p_vaddr + ph[i].p_filesz > file_end)
+            file_end = ph[i].p_vaddr + ph[i].p_filesz;
+        if (ph[i].p_vaddr + ph[i].p_memsz > mem_end)
+            mem_end = ph[i].p_vaddr + ph[i].p_memsz;
+    }
+
+    if (data_start == 0)
+        data_start = UP_TO_PAGE(file_end);
+    if (file_end < data_start)
+        file_end = data_start;
+
+    image = calloc(1, file_end - MEM_INVALID_SIZE);
+    if (image == NULL) {
+        free(ph);
+        return LI_OTHER_ERROR;
+    }
+    for (i = 0; i < eh.e_phnum; ++i) {
+        if (ph[i].p_type != PT_LOAD || ph[i].p_filesz == 0)
+            continue;
+        if (pread(fd, image + (ph[i].p_vaddr - MEM_INVALID_SIZE),
+            ph[i].p_filesz, ph[i].p_offset) != (ssize_t)ph[i].p_filesz) {
+            free(image);
+            free(ph);
+            return LI_FORMAT_ERROR;
+        }
+    }
+    free(ph);
+
+    /* Replace fd with the flattened image */
+    if ((img = memfd_create("yalnix-image", 0)) < 0 ||
+        write(img, image, file_end - MEM_INVALID_SIZE) !=
+        (ssize_t)(file_end - MEM_INVALID_SIZE) ||
+        lseek(img, 0, SEEK_SET) < 0 || dup2(img, fd) < 0) {
+        free(image);
+        return LI_OTHER_ERROR;
+    }
+    close(img);
+    free(image);
+
+    li->text_size = data_start - MEM_INVALID_SIZE;
+    li->data_size = file_end - data_start;
+    li->bss_size = mem_end > file_end ? mem_end - file_end : 0;
+    li->entry = eh.e_entry;
+
+    return LI_SUCCESS;
+}
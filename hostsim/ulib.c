@@ -0,0 +1,430 @@
+/*
+ *  User-level library for Yalnix programs run on the host stand-in.
+ *
+ *  Provides the program entry point, the kernel call stubs declared in
+ *  yalnix.h, TracePrintf/TtyPrintf, and the handful of C library
+ *  routines user programs and the compiler expect (string functions,
+ *  printf-style formatting and a Brk-based malloc).
+ */
+
+#include <stdarg.h>
+#include <stddef.h>
+
+#include <comp421/hardware.h>
+#include <comp421/yalnix.h>
+
+#include "hostsim.h"
+
+extern int main(int, char **);
+extern char _end;
+
+/*
+ *  Kernel calls
+ */
+static inline long
+trap(long call, long a1, long a2, long a3, long a4)
+{
+    register long rax __asm__("rax") = call;
+    register long rdi __asm__("rdi") = a1;
+    register long rsi __asm__("rsi") = a2;
+    register long rdx __asm__("rdx") = a3;
+    register long rcx __asm__("rcx") = a4;
+
+    __asm__ volatile("ud2"
+        : "+r"(rax), "+r"(rdi), "+r"(rsi), "+r"(rdx), "+r"(rcx)
+        : : "r8", "r9", "r10", "r11", "memory");
+    return rax;
+}
+
+#define TRAP0(c)            trap((c), 0, 0, 0, 0)
+#define TRAP1(c, a)         trap((c), (long)(a), 0, 0, 0)
+#define TRAP2(c, a, b)      trap((c), (long)(a), (long)(b), 0, 0)
+#define TRAP3(c, a, b, d)   trap((c), (long)(a), (long)(b), (long)(d), 0)
+#define TRAP4(c, a, b, d, e) trap((c), (long)(a), (long)(b), (long)(d), (long)(e))
+
+int Fork(void) { return TRAP0(YALNIX_FORK); }
+int Exec(char *file, char **argv) { return TRAP2(YALNIX_EXEC, file, argv); }
+int Spawn(char *file, char **argv) { return TRAP2(YALNIX_SPAWN, file, argv); }
+int PoolSpawn(char *file, char **argv)
+    { return TRAP2(YALNIX_POOL_SPAWN, file, argv); }
+int ShmCreate(int size) { return TRAP1(YALNIX_SHM_CREATE, size); }
+void *ShmAttach(int id)
+{
+    long addr = TRAP1(YALNIX_SHM_ATTACH, id);
+
+    return addr == ERROR ? NULL : (void *)addr;
+}
+int ShmDetach(void *addr) { return TRAP1(YALNIX_SHM_DETACH, addr); }
+int Wait(int *status) { return TRAP1(YALNIX_WAIT, status); }
+int GetPid(void) { return TRAP0(YALNIX_GETPID); }
+int Brk(void *addr) { return TRAP1(YALNIX_BRK, addr); }
+int Delay(int ticks) { return TRAP1(YALNIX_DELAY, ticks); }
+int TtyRead(int tty, void *buf, int len)
+    { return TRAP3(YALNIX_TTY_READ, tty, buf, len); }
+int TtyWrite(int tty, void *buf, int len)
+    { return TRAP3(YALNIX_TTY_WRITE, tty, buf, len); }
+int Register(unsigned int index) { return TRAP1(YALNIX_REGISTER, index); }
+int Send(void *msg, int pid) { return TRAP2(YALNIX_SEND, msg, pid); }
+int Receive(void *msg) { return TRAP1(YALNIX_RECEIVE, msg); }
+int ReceiveSpecific(void *msg, int pid)
+    { return TRAP2(YALNIX_RECEIVESPECIFIC, msg, pid); }
+int Reply(void *msg, int pid) { return TRAP2(YALNIX_REPLY, msg, pid); }
+int Forward(void *msg, int dst, int src)
+    { return TRAP3(YALNIX_FORWARD, msg, dst, src); }
+int CopyFrom(int pid, void *dst, void *src, int len)
+    { return TRAP4(YALNIX_COPY_FROM, pid, dst, src, len); }
+int CopyTo(int pid, void *dst, void *src, int len)
+    { return TRAP4(YALNIX_COPY_TO, pid, dst, src, len); }
+int ReadSector(int sector, void *buf)
+    { return TRAP2(YALNIX_READ_SECTOR, sector, buf); }
+int WriteSector(int sector, void *buf)
+    { return TRAP2(YALNIX_WRITE_SECTOR, sector, buf); }
+int DiskStats(struct diskstats *stats)
+    { return TRAP1(YALNIX_DISK_STATS, stats); }
+int DiskSync(void) { return TRAP0(YALNIX_DISK_SYNC); }
+int ReadSectors(int start, int count, void *buf)
+    { return TRAP3(YALNIX_READ_SECTORS, start, count, buf); }
+int WriteSectors(int start, int count, void *buf)
+    { return TRAP3(YALNIX_WRITE_SECTORS, start, count, buf); }
+int GetTicks(void) { return TRAP0(YALNIX_GET_TICKS); }
+int Profile(int op) { return TRAP1(YALNIX_PROFILE, op); }
+int GetStats(int pid, struct procstats *stats)
+    { return TRAP2(YALNIX_GET_STATS, pid, stats); }
+
+void
+Exit(int status)
+{
+    TRAP1(YALNIX_EXIT, status);
+    for (;;)
+        ;
+}
+
+void
+Pause(void)
+{
+    TRAP0(SIM_CALL_PAUSE);
+}
+
+/*
+ *  Program entry.  LoadProgram leaves argc at the stack pointer,
+ *  followed by the argv pointers.
+ */
+void __attribute__((used, noreturn))
+__ustart(long *sp)
+{
+    Exit(main((int)sp[0], (char **)(sp + 1)));
+}
+
+__asm__(
+    ".section .text.start, \"ax\"\n"
+    ".globl _start\n"
+    "_start:\n"
+    "   mov %rsp, %rdi\n"
+    "   and $-16, %rsp\n"
+    "   call __ustart\n"
+    "   ud2\n"
+    ".previous\n");
+
+/*
+ *  String and memory routines
+ */
+void *
+memcpy(void *dst, const void *src, size_t n)
+{
+    char *d = dst;
+    const char *s = src;
+
+    while (n--)
+        *d++ = *s++;
+    return dst;
+}
+
+void *
+memmove(void *dst, const void *src, size_t n)
+{
+    char *d = dst;
+    const char *s = src;
+
+    if (d < s) {
+        while (n--)
+            *d++ = *s++;
+    } else {
+        while (n--)
+            d[n] = s[n];
+    }
+    return dst;
+}
+
+void *
+memset(void *dst, int c, size_t n)
+{
+    char *d = dst;
+
+    while (n--)
+        *d++ = c;
+    return dst;
+}
+
+int
+memcmp(const void *a, const void *b, size_t n)
+{
+    const unsigned char *x = a, *y = b;
+
+    for (; n; --n, ++x, ++y) {
+        if (*x != *y)
+            return *x - *y;
+    }
+    return 0;
+}
+
+size_t
+strlen(const char *s)
+{
+    size_t n = 0;
+
+    while (s[n])
+        ++n;
+    return n;
+}
+
+char *
+strcpy(char *dst, const char *src)
+{
+    char *d = dst;
+
+    while ((*d++ = *src++))
+        ;
+    return dst;
+}
+
+int
+strcmp(const char *a, const char *b)
+{
+    while (*a && *a == *b)
+        ++a, ++b;
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+int
+atoi(const char *s)
+{
+    int n = 0, neg = 0;
+
+    if (*s == '-')
+        neg = 1, ++s;
+    while (*s >= '0' && *s <= '9')
+        n = n * 10 + (*s++ - '0');
+    return neg ? -n : n;
+}
+
+/*
+ *  Formatting: %d %i %u %x %p %s %c %ld %lu %lx and %%, with width,
+ *  zero padding and left adjustment.
+ */
+static void
+put(char *buf, size_t size, size_t *pos, char c)
+{
+    if (*pos + 1 < size)
+        buf[*pos] = c;
+    ++*pos;
+}
+
+int
+vsnprintf(char *buf, size_t size, const char *fmt, va_list ap)
+{
+    size_t pos = 0;
+    char tmp[24];
+
+    for (; *fmt; ++fmt) {
+        int width = 0, left = 0, zero = 0, lng = 0, n = 0;
+        unsigned long u;
+        const char *s;
+
+        if (*fmt != '%') {
+            put(buf, size, &pos, *fmt);
+            continue;
+        }
+        ++fmt;
+        for (; *fmt == '-' || *fmt == '0'; ++fmt) {
+            if (*fmt == '-')
+                left = 1;
+            else
+                zero = 1;
+        }
+        while (*fmt >= '0' && *fmt <= '9')
+            width = width * 10 + (*fmt++ - '0');
+        while (*fmt == 'l')
+            lng = 1, ++fmt;
+
+        s = tmp;
+        switch (*fmt) {
+        case 'd':
+        case 'i': {
+            long v = lng ? va_arg(ap, long) : va_arg(ap, int);
+            int neg = v < 0;
+
+            u = neg ? -(unsigned long)v : (unsigned long)v;
+            do { tmp[sizeof(tmp) - 1 - n++] = '0' + u % 10; } while (u /= 10);
+            if (neg)
+                tmp[sizeof(tmp) - 1 - n++] = '-';
+            s = tmp + sizeof(tmp) - n;
+            break;
+        }
+        case 'u':
+            u = lng ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+            do { tmp[sizeof(tmp) - 1 - n++] = '0' + u % 10; } while (u /= 10);
+            s = tmp + sizeof(tmp) - n;
+            break;
+        case 'p':
+            lng = 1;
+            /* fall through */
+        case 'x':
+            u = lng ? va_arg(ap, unsigned long) : va_arg(ap, unsigned int);
+            do {
+                tmp[sizeof(tmp) - 1 - n++] = "0123456789abcdef"[u % 16];
+            } while (u /= 16);
+            s = tmp + sizeof(tmp) - n;
+            break;
+        case 's':
+            s = va_arg(ap, const char *);
+            if (s == NULL)
+                s = "(null)";
+            n = strlen(s);
+            break;
+        case 'c':
+            tmp[0] = va_arg(ap, int);
+            n = 1;
+            break;
+        case '%':
+            tmp[0] = '%';
+            n = 1;
+            break;
+        default:
+            continue;
+        }
+
+        if (!left) {
+            for (; width > n; --width)
+                put(buf, size, &pos, zero ? '0' : ' ');
+        }
+        for (; n > 0; --n, --width)
+            put(buf, size, &pos, *s++);
+        for (; width > 0; --width)
+            put(buf, size, &pos, ' ');
+    }
+
+    if (size > 0)
+        buf[pos < size ? pos : size - 1] = '\0';
+    return pos;
+}
+
+int
+snprintf(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, size, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+int
+sprintf(char *buf, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, TERMINAL_MAX_LINE, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+void
+TracePrintf(int level, char *fmt, ...)
+{
+    char buf[256];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n >= (int)sizeof(buf))
+        n = sizeof(buf) - 1;
+    TRAP3(SIM_CALL_TRACE, level, buf, n);
+}
+
+int
+TtyPrintf(int tty, char *fmt, ...)
+{
+    char buf[TERMINAL_MAX_LINE];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (n >= (int)sizeof(buf))
+        n = sizeof(buf) - 1;
+    return TtyWrite(tty, buf, n);
+}
+
+/*
+ *  Memory allocation: a first-fit free list on top of Brk.
+ */
+struct block {
+    size_t size;
+    struct block *next;
+};
+
+static char *heap_brk;
+static struct block *free_list;
+
+void *
+sbrk(long incr)
+{
+    char *old;
+
+    if (heap_brk == NULL)
+        heap_brk = (char *)UP_TO_PAGE(&_end);
+    old = heap_brk;
+    if (Brk(heap_brk + incr) == ERROR)
+        return (void *)-1;
+    heap_brk += incr;
+    return old;
+}
+
+void *
+malloc(size_t size)
+{
+    struct block **bp, *b;
+
+    size = (size + 15) & ~(size_t)15;
+    for (bp = &free_list; (b = *bp) != NULL; bp = &b->next) {
+        if (b->size >= size) {
+            *bp = b->next;
+            return b + 1;
+        }
+    }
+
+    b = sbrk(sizeof(struct block) + size);
+    if (b == (void *)-1)
+        return NULL;
+    b->size = size;
+    return b + 1;
+}
+
+void
+free(void *p)
+{
+    struct block *b;
+
+    if (p == NULL)
+        return;
+    b = (struct block *)p - 1;
+    b->next = free_list;
+    free_list = b;
+}
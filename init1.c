@@ -1,4 +1,5 @@
 #include <unistd.h>
+#include <comp421/hardware.h>
 #include <comp421/yalnix.h>
 
 int
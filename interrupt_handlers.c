@@ -2,81 +2,267 @@
 #include<stdlib.h>
 #include "kernel.h"
 
+/*
+ * Kernel call wrappers, which unpack the arguments of each kernel
+ * call from the ExceptionInfo struct. The return value is passed
+ * back to the user in regs[0].
+ */
+static int sys_fork(ExceptionInfo *info) {
+    return KernelFork();
+}
+
+static int sys_exec(ExceptionInfo *info) {
+    KernelExec(info);
+    return info->regs[0];
+}
+
+static int sys_spawn(ExceptionInfo *info) {
+    return KernelSpawn((char *) (info->regs[1]), (char **) (info->regs[2]),
+        info);
+}
+
+static int sys_pool_spawn(ExceptionInfo *info) {
+    return KernelPoolSpawn((char *) (info->regs[1]),
+        (char **) (info->regs[2]), info);
+}
+
+static int sys_shm_create(ExceptionInfo *info) {
+    return KernelShmCreate((int) (info->regs[1]));
+}
+
+static int sys_shm_attach(ExceptionInfo *info) {
+    return KernelShmAttach((int) (info->regs[1]));
+}
+
+static int sys_shm_detach(ExceptionInfo *info) {
+    return KernelShmDetach((void *) (info->regs[1]));
+}
+
+static int sys_exit(ExceptionInfo *info) {
+    KernelExit((int) (info->regs[1]));
+    return 0;
+}
+
+static int sys_wait(ExceptionInfo *info) {
+    return KernelWait((int *) (info->regs[1]));
+}
+
+static int sys_getpid(ExceptionInfo *info) {
+    return active_process->pid;
+}
+
+static int sys_brk(ExceptionInfo *info) {
+    return KernelBrk((void *) (info->regs[1]));
+}
+
+static int sys_delay(ExceptionInfo *info) {
+    return KernelDelay((int) (info->regs[1]));
+}
+
+static int sys_tty_read(ExceptionInfo *info) {
+    int len = KernelTtyRead((int) (info->regs[1]), (void *) (info->regs[2]),
+        (int) (info->regs[3]));
+
+    if (len > 0)
+        active_process->tty_in += len;
+    return len;
+}
+
+static int sys_tty_write(ExceptionInfo *info) {
+    int len = KernelTtyWrite((int) (info->regs[1]), (void *) (info->regs[2]),
+        (int) (info->regs[3]));
+
+    if (len > 0)
+        active_process->tty_out += len;
+    return len;
+}
+
+static int sys_register(ExceptionInfo *info) {
+    return KernelRegister((unsigned int) (info->regs[1]));
+}
+
+static int sys_send(ExceptionInfo *info) {
+    return KernelSend((void *) (info->regs[1]), (int) (info->regs[2]));
+}
+
+static int sys_receive(ExceptionInfo *info) {
+    return KernelReceive((void *) (info->regs[1]));
+}
+
+static int sys_receive_specific(ExceptionInfo *info) {
+    return KernelReceiveSpecific((void *) (info->regs[1]),
+        (int) (info->regs[2]));
+}
+
+static int sys_reply(ExceptionInfo *info) {
+    return KernelReply((void *) (info->regs[1]), (int) (info->regs[2]));
+}
+
+static int sys_forward(ExceptionInfo *info) {
+    return KernelForward((void *) (info->regs[1]), (int) (info->regs[2]),
+        (int) (info->regs[3]));
+}
+
+static int sys_copy_from(ExceptionInfo *info) {
+    return KernelCopyFrom((int) (info->regs[1]), (void *) (info->regs[2]),
+        (void *) (info->regs[3]), (int) (info->regs[4]));
+}
+
+static int sys_copy_to(ExceptionInfo *info) {
+    return KernelCopyTo((int) (info->regs[1]), (void *) (info->regs[2]),
+        (void *) (info->regs[3]), (int) (info->regs[4]));
+}
+
+static int sys_read_sector(ExceptionInfo *info) {
+    return KernelReadSector((int) (info->regs[1]), (void *) (info->regs[2]));
+}
+
+static int sys_write_sector(ExceptionInfo *info) {
+    return KernelWriteSector((int) (info->regs[1]), (void *) (info->regs[2]));
+}
+
+static int sys_disk_stats(ExceptionInfo *info) {
+    return KernelDiskStats((struct diskstats *) (info->regs[1]));
+}
+
+static int sys_disk_sync(ExceptionInfo *info) {
+    return KernelDiskSync();
+}
+
+static int sys_read_sectors(ExceptionInfo *info) {
+    return KernelReadSectors((int) (info->regs[1]), (int) (info->regs[2]),
+        (void *) (info->regs[3]));
+}
+
+static int sys_write_sectors(ExceptionInfo *info) {
+    return KernelWriteSectors((int) (info->regs[1]), (int) (info->regs[2]),
+        (void *) (info->regs[3]));
+}
+
+static int sys_get_ticks(ExceptionInfo *info) {
+    return clock_count;
+}
+
+static int sys_get_stats(ExceptionInfo *info) {
+    return KernelGetStats((int) (info->regs[1]),
+        (struct procstats *) (info->regs[2]));
+}
+
+static int sys_profile(ExceptionInfo *info) {
+    return KernelProfile((int) (info->regs[1]));
+}
+
+/*
+ * Kernel call dispatch table, indexed by kernel call number.
+ * Each entry counts its calls and the clock ticks spent in them.
+ */
+struct syscall_entry syscall_table[SYSCALL_TABLE_SIZE] = {
+    [YALNIX_FORK]       = { sys_fork, "Fork" },
+    [YALNIX_EXEC]       = { sys_exec, "Exec" },
+    [YALNIX_EXIT]       = { sys_exit, "Exit" },
+    [YALNIX_WAIT]       = { sys_wait, "Wait" },
+    [YALNIX_GETPID]     = { sys_getpid, "GetPid" },
+    [YALNIX_BRK]        = { sys_brk, "Brk" },
+    [YALNIX_DELAY]      = { sys_delay, "Delay" },
+    [YALNIX_TTY_READ]   = { sys_tty_read, "TtyRead" },
+    [YALNIX_TTY_WRITE]  = { sys_tty_write, "TtyWrite" },
+    [YALNIX_REGISTER]   = { sys_register, "Register" },
+    [YALNIX_SEND]       = { sys_send, "Send" },
+    [YALNIX_RECEIVE]    = { sys_receive, "Receive" },
+    [YALNIX_RECEIVESPECIFIC] = { sys_receive_specific, "ReceiveSpecific" },
+    [YALNIX_REPLY]      = { sys_reply, "Reply" },
+    [YALNIX_FORWARD]    = { sys_forward, "Forward" },
+    [YALNIX_COPY_FROM]  = { sys_copy_from, "CopyFrom" },
+    [YALNIX_COPY_TO]    = { sys_copy_to, "CopyTo" },
+    [YALNIX_READ_SECTOR]  = { sys_read_sector, "ReadSector" },
+    [YALNIX_WRITE_SECTOR] = { sys_write_sector, "WriteSector" },
+    [YALNIX_DISK_STATS] = { sys_disk_stats, "DiskStats" },
+    [YALNIX_DISK_SYNC]  = { sys_disk_sync, "DiskSync" },
+    [YALNIX_READ_SECTORS]  = { sys_read_sectors, "ReadSectors" },
+    [YALNIX_WRITE_SECTORS] = { sys_write_sectors, "WriteSectors" },
+    [YALNIX_GET_TICKS]  = { sys_get_ticks, "GetTicks" },
+    [YALNIX_GET_STATS]  = { sys_get_stats, "GetStats" },
+    [YALNIX_PROFILE]    = { sys_profile, "Profile" },
+    [YALNIX_SPAWN]      = { sys_spawn, "Spawn" },
+    [YALNIX_POOL_SPAWN] = { sys_pool_spawn, "PoolSpawn" },
+    [YALNIX_SHM_CREATE] = { sys_shm_create, "ShmCreate" },
+    [YALNIX_SHM_ATTACH] = { sys_shm_attach, "ShmAttach" },
+    [YALNIX_SHM_DETACH] = { sys_shm_detach, "ShmDetach" },
+};
+
 /*
  * Interrupt handler for TRAP_KERNEL interrupt.
+ *
+ * Unknown kernel calls return ERROR to the caller.
  */
 void trap_kernel_handler(ExceptionInfo *exceptionInfo) {
+    int code = exceptionInfo->code;
+    unsigned int start = clock_count;
+    struct syscall_entry *entry;
 
-    switch (exceptionInfo->code) {
-    case YALNIX_FORK:
-        exceptionInfo->regs[0] = KernelFork();
-        break;
+    record_trap(exceptionInfo);
 
-    case YALNIX_EXEC:
-        KernelExec(exceptionInfo);
-        break;
+    if (code < 0 || code >= SYSCALL_TABLE_SIZE
+        || syscall_table[code].handler == NULL) {
+        TracePrintf(0, "invalid trap call %d from process %d\n", code,
+            active_process->pid);
+        exceptionInfo->regs[0] = ERROR;
+        return;
+    }
 
-    case YALNIX_EXIT:
-        KernelExit((int) (exceptionInfo->regs[1]));
+    entry = &syscall_table[code];
+    ++entry->calls;
+    ++active_process->syscalls;
 
-    case YALNIX_WAIT:
-        exceptionInfo->regs[0] =
-            KernelWait((int *) (exceptionInfo->regs[1]));
-        break;
+    TRACE_EVENT(TRACE_SYSCALL, code, 0);
 
-    case YALNIX_GETPID:
-        exceptionInfo->regs[0] = active_process->pid;
-        break;
+    exceptionInfo->regs[0] = entry->handler(exceptionInfo);
 
-    case YALNIX_BRK:
-        exceptionInfo->regs[0] = KernelBrk(
-            (void *) (exceptionInfo->regs[1]));
-        break;
+    TRACE_EVENT(TRACE_SYSRET, code, exceptionInfo->regs[0]);
 
-    case YALNIX_DELAY:
-        exceptionInfo->regs[0] = KernelDelay(
-            (int) (exceptionInfo->regs[1]));
-        break;
+    entry->ticks += clock_count - start;
+}
 
-    case YALNIX_TTY_READ:
-        exceptionInfo->regs[0] = KernelTtyRead(
-            (int) (exceptionInfo->regs[1]),
-            (void *) (exceptionInfo->regs[2]),
-            (int) (exceptionInfo->regs[3]));
-        break;
+/*
+ * Prints the number of calls made to each kernel call, and the
+ * average number of clock ticks they took.
+ */
+void print_syscall_stats(void) {
+    int i;
 
-    case YALNIX_TTY_WRITE:
-        exceptionInfo->regs[0] = KernelTtyWrite(
-            (int) (exceptionInfo->regs[1]),
-            (void *) (exceptionInfo->regs[2]),
-            (int) (exceptionInfo->regs[3]));
-        break;
+    for (i = 0; i < SYSCALL_TABLE_SIZE; ++i) {
+        if (syscall_table[i].calls == 0)
+            continue;
 
-    default :
-        TracePrintf(0, "invalid trap call");
-        Halt();
+        TracePrintf(0, "SYSCALL: %-16s %8u calls %8u ticks %5u.%02u avg\n",
+            syscall_table[i].name, syscall_table[i].calls,
+            syscall_table[i].ticks,
+            syscall_table[i].ticks / syscall_table[i].calls,
+            100 * syscall_table[i].ticks / syscall_table[i].calls % 100);
     }
-
 }
 
 /*
  * Interrupt handler for TRAP_CLOCK interrupt.
  */
 void trap_clock_handler(ExceptionInfo *exceptionInfo) {
-    TracePrintf(1, "trap_clock_handler - Active process: %u\n",
-                active_process->pid);
+    record_trap(exceptionInfo);
+    TRACE_EVENT(TRACE_CLOCK, exceptionInfo->pc, 0);
+    profile_tick(exceptionInfo);
+
+    // Charge the tick to the running process. Processes ready to run
+    // are charged as they leave the ready queue, so count the tick
+    // before waking any, which have not waited through it
+    ++active_process->ticks_run;
+    ++clock_count;
 
     // Decrement all waiting processes and move any completed
     // processes onto the ready queue.
     struct process_info *waiting_process = waiting_queue;
     while (waiting_process != NULL) {
-        TracePrintf(1, "decrementing waiting_process process %d\n", waiting_process->pid);
         waiting_process->delay_ticks--;
-        TracePrintf(1, "new value %d\n", waiting_process->delay_ticks);
 
         if (waiting_process->delay_ticks < 1) {
-            TracePrintf(1, "process %d unblocking\n", waiting_process->pid);
-
             // Remove process from waiting queue
             remove_process(&waiting_queue, &wq_tail, waiting_process);
 
@@ -90,22 +276,28 @@ void trap_clock_handler(ExceptionInfo *exceptionInfo) {
     }
 
     // If any processes are available, switch to them.
-    TracePrintf(1, "pq before switch %p\n", (void*)process_queue);
-    if ((last_switch - (++clock_count) <= -2 || active_process->pid == 0)
+    if ((last_switch - clock_count <= -2 || active_process->pid == 0)
         && process_queue != NULL) {
         struct process_info *next = pop_process(&process_queue, &pq_tail);
 
-        TracePrintf(1, "Popped process %d off queue\n", next->pid);
-
         last_switch = clock_count;
 
         // If active process is not idle, return it to the queue.
-        if (active_process->pid != idle->pid)
+        if (active_process->pid != idle->pid) {
             push_process(&process_queue, &pq_tail, active_process);
+            ++active_process->preemptions;
+        }
 
         ContextSwitch(ContextSwitchFunc, &(active_process->ctx),
                       (void *)active_process, (void *)next);
     }
+
+    // Idle, either now or when switched back to, so spend the time
+    // clearing free pages and loading processes for PoolSpawn
+    if (active_process == idle) {
+        zero_free_pages();
+        pool_refill(exceptionInfo);
+    }
 }
 
 /*
@@ -114,6 +306,8 @@ void trap_clock_handler(ExceptionInfo *exceptionInfo) {
 void trap_illegal_handler(ExceptionInfo *exceptionInfo) {
     char *msg;
 
+    record_trap(exceptionInfo);
+
     switch (exceptionInfo->code) {
     case TRAP_ILLEGAL_ILLOPC:
         msg = "Illegal opcode";
@@ -157,6 +351,8 @@ void trap_illegal_handler(ExceptionInfo *exceptionInfo) {
     case TRAP_ILLEGAL_KERNELB:
         msg = "Linux kernel sent SIGBUS";
         break;
+    default:
+        msg = "Unknown";
     }
 
     fprintf(stderr, "ERROR: Process %d terminated. Reason: %s\n",
@@ -169,52 +365,84 @@ void trap_illegal_handler(ExceptionInfo *exceptionInfo) {
  * Interrupt handler for TRAP_MEMORY interrupt.
  */
 void trap_memory_handler(ExceptionInfo *exceptionInfo) {
-    int i;
-
-    TracePrintf(0, "TRAP_MEMORY - pid = %d\n", active_process->pid);
-
     void *addr = exceptionInfo->addr;
 
+    record_trap(exceptionInfo);
+    TRACE_EVENT(TRACE_FAULT, addr, 0);
+    ++active_process->page_faults;
+
     if ((long)addr > USER_STACK_LIMIT || (long)addr < MEM_INVALID_SIZE) {
         fprintf(stderr, "ERROR: Process %d attempted to access an invalid address: %p\n",
             active_process->pid, addr);
         KernelExit(ERROR);
     }
 
-    // Check if expanding stack pushes into the heap.
-    if (DOWN_TO_PAGE(addr) - PAGESIZE < (long)(active_process->user_brk) ) {
-        fprintf(stderr, "ERROR: Stackoverflow, process %d, requested address %p\n",
-            active_process->pid, (void *)addr);
-        KernelExit(ERROR);
+    // The pageout clock took access away to see if the page is used
+    struct pte *pte = CURRENT_PAGE_TABLE + ((long)addr >> PAGESHIFT);
+    if (pte->valid && (pte->unused & PTE_UNREFERENCED)) {
+        pte->unused &= ~PTE_UNREFERENCED;
+        pte->uprot = pte->kprot;
+        flush_tlb((RCS421RegVal)DOWN_TO_PAGE(addr));
+        return;
     }
 
-    int heap_pages = ((long)active_process->user_brk - MEM_INVALID_SIZE)
-        >> PAGESHIFT;
-    int stack_pages = active_process->user_pages - heap_pages;
-
-    void *cur_stack = USER_STACK_LIMIT - (stack_pages << PAGESHIFT);
+    // Read the page back from swap, and retry the access
+    if (pte->unused & PTE_SWAPPED) {
+        if (swap_in(active_process, (long)addr >> PAGESHIFT) == ERROR) {
+            fprintf(stderr, "ERROR: Process %d out of memory at %p\n",
+                active_process->pid, addr);
+            KernelExit(ERROR);
+        }
+        return;
+    }
 
-    int num_new_pages = (DOWN_TO_PAGE(cur_stack) - DOWN_TO_PAGE(addr))
-        >> PAGESHIFT;
+    // Both of the cases below need a frame. If we had to block for
+    // one, the page may have changed, so retry the access.
+    if ((pte->valid && (pte->unused & PTE_COPY_ON_WRITE))
+        || (!pte->valid
+            && (long)addr < (long)UP_TO_PAGE(active_process->user_brk))) {
+        switch (reserve_frames(1)) {
+        case ERROR:
+            fprintf(stderr, "ERROR: Process %d out of memory at %p\n",
+                active_process->pid, addr);
+            KernelExit(ERROR);
+        case 1:
+            return;
+        }
+    }
 
-    if (num_new_pages > tot_pmem_pages - allocated_pages) {
-        fprintf(stderr, "ERROR: Unable to allocate memory for stack, process %d\n",
-            active_process->pid);
-        KernelExit(ERROR);
+    // A write to a shared page gets a private copy of it
+    if (pte->valid && (pte->unused & PTE_COPY_ON_WRITE)) {
+        copy_on_write(active_process, (long)addr >> PAGESHIFT);
+        return;
     }
 
-    struct pte *page_table = (struct pte *)(VMEM_LIMIT - PAGESIZE);
+    // Heap pages are reserved by Brk and only backed on first touch.
+    // The fault does not say whether it was a read, so assume a write.
+    if ((long)addr < (long)UP_TO_PAGE(active_process->user_brk)) {
+        if (alloc_heap_page(active_process, (long)addr >> PAGESHIFT, 1)
+            == ERROR) {
+            fprintf(stderr, "ERROR: Process %d attempted to access an invalid address: %p\n",
+                active_process->pid, addr);
+            KernelExit(ERROR);
+        }
+        return;
+    }
 
-    for (i = 0; i < num_new_pages; ++i) {
-        *(page_table + (USER_STACK_LIMIT >> PAGESHIFT) - stack_pages - i - 1) =
-            (struct pte) {
-            .pfn = alloc_page(),
-            .uprot = PROT_READ | PROT_WRITE,
-            .kprot = PROT_READ | PROT_WRITE,
-            .valid = 1
-        };
+    // The stack is mapped down to stack_base, so a fault there is not
+    // a request for more stack
+    if ((long)addr >= (long)active_process->stack_base) {
+        fprintf(stderr, "ERROR: Process %d attempted to access an invalid address: %p\n",
+            active_process->pid, addr);
+        KernelExit(ERROR);
     }
 
+    // Grow the stack down to the faulting address, and possibly further
+    if (grow_user_stack(addr) == ERROR) {
+        fprintf(stderr, "ERROR: Stackoverflow, process %d, requested address %p\n",
+            active_process->pid, (void *)addr);
+        KernelExit(ERROR);
+    }
 }
 
 /*
@@ -223,6 +451,8 @@ void trap_memory_handler(ExceptionInfo *exceptionInfo) {
 void trap_math_handler(ExceptionInfo *exceptionInfo) {
     char *msg;
 
+    record_trap(exceptionInfo);
+
     switch (exceptionInfo->code) {
     case TRAP_MATH_INTDIV:
         msg = "Integer divide by zero";
@@ -254,6 +484,8 @@ void trap_math_handler(ExceptionInfo *exceptionInfo) {
     case TRAP_MATH_USER:
         msg = "Received SIGFPE from user";
         break;
+    default:
+        msg = "Unknown";
     }
 
     fprintf(stderr, "ERROR: Process %d terminated. Reason: %s\n",
@@ -266,6 +498,7 @@ void trap_math_handler(ExceptionInfo *exceptionInfo) {
  * Interrupt handler for TRAP_TTY_TRANSMIT interrupt.
  */
 void trap_tty_transmit_handler(ExceptionInfo *exceptionInfo) {
+    record_trap(exceptionInfo);
     TracePrintf(1, "trap_tty_transmit_handler");
 
     struct terminal_info *terminal = terminals[exceptionInfo->code];
@@ -283,6 +516,7 @@ void trap_tty_transmit_handler(ExceptionInfo *exceptionInfo) {
  * Interrupt handler for TRAP_TTY_RECEIVE interrupt.
  */
 void trap_tty_receive_handler(ExceptionInfo *exceptionInfo) {
+    record_trap(exceptionInfo);
     TracePrintf(1, "trap_tty_receive_handler");
 
     //get the correct terminal info
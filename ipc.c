@@ -0,0 +1,589 @@
+#include <string.h>
+
+#include "kernel.h"
+
+/*
+ * Messages are passed directly between pcbs. A sender copies its
+ * message into its own pcb and queues itself, which the receiver
+ * copies the message straight out of. The reply is written into the
+ * sender's pcb in the same way, so no message is ever buffered on
+ * the kernel heap.
+ *
+ * A message sent to a pid waits in the queue of that process, and a
+ * message sent to a server index in the queue of the service, so
+ * either send is a constant time enqueue. Receive takes the oldest
+ * message from the process's own queue and the queues of the
+ * services it registered. ReceiveSpecific finds the sender through
+ * the pid table, and unlinks its message without searching a queue.
+ */
+
+/*
+ * Finds the queue a message addressed to pid goes in, and sets *dest
+ * to the process which will receive it. A negative pid names the
+ * server registered at index -pid.
+ *
+ * Returns NULL if there is no such process.
+ */
+static struct message_queue *find_queue(int pid, struct process_info **dest) {
+    if (pid < 0) {
+        if (-pid > MAX_SERVER_INDEX || services[-pid].server == NULL)
+            return NULL;
+
+        *dest = services[-pid].server;
+        return &services[-pid].messages;
+    }
+
+    // Idle never takes part in IPC
+    if (pid == 0 || (*dest = find_process(pid)) == NULL)
+        return NULL;
+
+    return &(*dest)->messages;
+}
+
+/*
+ * Finds the process with the given pid, provided it is blocked
+ * waiting for a Reply from the active process.
+ *
+ * Returns NULL if there is no such process.
+ */
+static struct process_info *find_replier(int pid) {
+    struct process_info *sender = pid > 0 ? find_process(pid) : NULL;
+
+    if (sender == NULL || sender->msg_state != IPC_REPLY_BLOCKED
+        || sender->msg_dest != active_process->pid)
+        return NULL;
+
+    return sender;
+}
+
+/*
+ * Queues the message held in sender's pcb on queue, for dest.
+ *
+ * Returns 1 if dest is blocked waiting for this message, in which
+ * case the caller must make dest runnable, 0 otherwise.
+ */
+static int queue_message(struct process_info *sender,
+    struct message_queue *queue, struct process_info *dest) {
+
+    sender->msg_state = IPC_SEND_BLOCKED;
+    sender->msg_dest = dest->pid;
+    sender->msg_queue = queue;
+    sender->msg_seq = next_msg_seq++;
+    push_process(&queue->head, &queue->tail, sender);
+
+    if (dest->msg_state != IPC_RECEIVE_BLOCKED
+        || (dest->receive_from != 0 && dest->receive_from != sender->pid))
+        return 0;
+
+    dest->msg_state = IPC_NONE;
+    return 1;
+}
+
+/*
+ * Unblocks a sender, whose Send call will return result.
+ */
+static void wake_sender(struct process_info *sender, int result) {
+    sender->msg_state = IPC_NONE;
+    sender->msg_result = result;
+    push_process(&process_queue, &pq_tail, sender);
+}
+
+/*
+ * Finds the oldest message waiting for the active process, either
+ * in its own queue or in the queue of a service it registered.
+ *
+ * Returns the sender, or NULL if no message is waiting.
+ */
+static struct process_info *oldest_message(void) {
+    struct process_info *oldest = active_process->messages.head;
+    struct process_info *head;
+    unsigned int index;
+
+    for (index = 1; active_process->services >> index; ++index) {
+        if (!(active_process->services & (1 << index)))
+            continue;
+
+        head = services[index].messages.head;
+        if (head != NULL
+            && (oldest == NULL || (int)(head->msg_seq - oldest->msg_seq) < 0))
+            oldest = head;
+    }
+
+    return oldest;
+}
+
+/*
+ * Blocks until a message from pid arrives, or from any process if
+ * pid is 0, and copies it into msg.
+ *
+ * Returns the pid of the sender, or ERROR if pid does not exist.
+ */
+static int receive_message(void *msg, int pid) {
+    struct process_info *sender;
+
+    while (1) {
+        // msg may have been paged out while we were blocked
+        if (fault_in_pages(msg, MESSAGE_SIZE, 1) == ERROR)
+            return ERROR;
+
+        if (pid == 0)
+            sender = oldest_message();
+        else {
+            if ((sender = find_process(pid)) == NULL)
+                return ERROR;
+
+            if (sender->msg_state != IPC_SEND_BLOCKED
+                || sender->msg_dest != active_process->pid)
+                sender = NULL;
+        }
+
+        if (sender != NULL)
+            break;
+
+        TracePrintf(1, "RECEIVE: Process %d blocking\n", active_process->pid);
+        active_process->msg_state = IPC_RECEIVE_BLOCKED;
+        active_process->receive_from = pid;
+        RemoveSwitch();
+    }
+
+    remove_process(&sender->msg_queue->head, &sender->msg_queue->tail,
+        sender);
+    sender->msg_state = IPC_REPLY_BLOCKED;
+
+    memcpy(msg, sender->msg, MESSAGE_SIZE);
+
+    return sender->pid;
+}
+
+/*
+ * Finds the frame backing page vpn of pcb for a transfer, first
+ * reading it back from swap, or backing a heap page which pcb
+ * reserved but never touched. If write is set, a copy-on-write page
+ * is given a private frame. This may page out other pages of either
+ * process.
+ *
+ * Returns the pfn, or ERROR if the page is not mapped, or is not
+ * writable by pcb and write is set, or memory runs out.
+ */
+static int user_frame(struct process_info *pcb, long vpn, int write) {
+    struct pte *pte = pcb->pt_vaddr + vpn;
+
+    if (vpn < MEM_INVALID_PAGES || vpn >= PAGE_TABLE_LEN - KERNEL_STACK_PAGES)
+        return ERROR;
+
+    if ((pte->unused & PTE_SWAPPED) && swap_in(pcb, vpn) == ERROR)
+        return ERROR;
+
+    if (!pte->valid && ((write && reserve_frames(1) == ERROR)
+        || alloc_heap_page(pcb, vpn, write) == ERROR))
+        return ERROR;
+
+    if (write && (pte->unused & PTE_COPY_ON_WRITE)) {
+        if (reserve_frames(1) == ERROR)
+            return ERROR;
+        copy_on_write(pcb, vpn);
+    }
+
+    if (write && !(pte->kprot & PROT_WRITE))
+        return ERROR;
+
+    return pte->pfn;
+}
+
+/*
+ * Transfers page src_vpn of src to page dst_vpn of dst without
+ * copying it, by mapping the frame copy-on-write in both page
+ * tables. Whatever dst_vpn held before is freed. Only writable pages
+ * are shared, so the private copy made on the first write to either
+ * side is writable again.
+ *
+ * Returns ERROR if the pages cannot be shared, in which case nothing
+ * has changed, 0 otherwise.
+ */
+static int share_page(struct process_info *src, long src_vpn,
+    struct process_info *dst, long dst_vpn) {
+    struct pte *from = src->pt_vaddr + src_vpn;
+    struct pte *to = dst->pt_vaddr + dst_vpn;
+
+    if (src_vpn < MEM_INVALID_PAGES
+        || src_vpn >= PAGE_TABLE_LEN - KERNEL_STACK_PAGES
+        || dst_vpn < MEM_INVALID_PAGES
+        || dst_vpn >= PAGE_TABLE_LEN - KERNEL_STACK_PAGES)
+        return ERROR;
+
+    // Shared memory stays shared, so it is always copied
+    if (!from->valid || (from->unused & PTE_SHARED)
+        || (to->unused & PTE_SHARED)
+        || !((from->kprot & PROT_WRITE) || (from->unused & PTE_COPY_ON_WRITE)))
+        return ERROR;
+
+    // The destination is either a writable page or a reserved heap
+    // page. A page in swap is copied into instead.
+    if (to->valid) {
+        if (!((to->kprot & PROT_WRITE) || (to->unused & PTE_COPY_ON_WRITE)))
+            return ERROR;
+        if (to->pfn == from->pfn)
+            return 0;
+    } else if ((to->unused & PTE_SWAPPED)
+        || dst_vpn >= (long)UP_TO_PAGE(dst->user_brk) >> PAGESHIFT
+        || dst->heap_reserved == 0)
+        return ERROR;
+
+    // Each shared pte holds a committed page to pay for its first write
+    if (available_pages() < 2)
+        return ERROR;
+
+    if (to->valid)
+        free_user_page(to);
+    else {
+        --dst->heap_reserved;
+        --committed_pages;
+        ++dst->user_pages;
+    }
+
+    if (!(from->unused & PTE_COPY_ON_WRITE)) {
+        from->unused = PTE_COPY_ON_WRITE;
+        from->uprot = PROT_READ;
+        from->kprot = PROT_READ;
+        ++committed_pages;
+
+        if (src == active_process)
+            flush_tlb((RCS421RegVal)(src_vpn << PAGESHIFT));
+    }
+
+    *to = (struct pte) {
+        .pfn = from->pfn,
+        .unused = PTE_COPY_ON_WRITE,
+        .uprot = PROT_READ,
+        .kprot = PROT_READ,
+        .valid = 1
+    };
+    ++committed_pages;
+    ++(free_pages + from->pfn)->refs;
+
+    if (dst == active_process)
+        flush_tlb((RCS421RegVal)(dst_vpn << PAGESHIFT));
+
+    return 0;
+}
+
+/*
+ * Copies len bytes between the buffer local of the active process
+ * and the buffer remote of the process pid, which must be blocked
+ * waiting for a Reply from the active process. Copies into pid if
+ * to_remote is set, and out of it otherwise.
+ *
+ * Whole pages which are page aligned in both buffers are remapped
+ * copy-on-write instead of copied. The other pieces are copied with
+ * memcpy through the copy slots, which are mapped NUM_COPY_SLOTS
+ * pages of pid at a time, flushing only the slots used. A batch is
+ * collected again if paging in part of it paged out another.
+ *
+ * Returns 0 on success, ERROR on failure.
+ */
+static int copy_message_data(int pid, char *local, char *remote, int len,
+    int to_remote) {
+    struct process_info *peer = find_replier(pid);
+    unsigned int pfn[NUM_COPY_SLOTS];
+    unsigned int outs;
+    char *local_at[NUM_COPY_SLOTS];
+    char *batch_local, *batch_remote;
+    int offset[NUM_COPY_SLOTS];
+    int size[NUM_COPY_SLOTS];
+    int k, n, shared, batch_len, batch_remapped;
+    long local_vpn, remote_vpn;
+    int remapped = 0, copied = 0;
+
+    if (peer == NULL || len < 0)
+        return ERROR;
+
+    while (len > 0) {
+        batch_local = local;
+        batch_remote = remote;
+        batch_len = len;
+        batch_remapped = remapped;
+        outs = swap_outs;
+
+        // Collect the frames first, since backing a page of either
+        // process may itself use the copy slots
+        n = 0;
+        while (n < NUM_COPY_SLOTS && len > 0) {
+            offset[n] = (long)remote & PAGEOFFSET;
+            size[n] = PAGESIZE - offset[n] < len ? PAGESIZE - offset[n] : len;
+            local_at[n] = local;
+            local_vpn = (long)local >> PAGESHIFT;
+            remote_vpn = (long)remote >> PAGESHIFT;
+
+            local += size[n];
+            remote += size[n];
+            len -= size[n];
+
+            if (size[n] == PAGESIZE && ((long)local_at[n] & PAGEOFFSET) == 0) {
+                if (to_remote)
+                    shared = share_page(active_process, local_vpn,
+                        peer, remote_vpn);
+                else
+                    shared = share_page(peer, remote_vpn,
+                        active_process, local_vpn);
+
+                if (shared == 0) {
+                    ++remapped;
+                    continue;
+                }
+            }
+
+            if (fault_in_pages(local_at[n], size[n], !to_remote) == ERROR)
+                return ERROR;
+            if ((int)(pfn[n] = user_frame(peer, remote_vpn, to_remote)) == ERROR)
+                return ERROR;
+            ++n;
+        }
+
+        // Start the batch again if any of it was paged out
+        if (swap_outs != outs) {
+            local = batch_local;
+            remote = batch_remote;
+            len = batch_len;
+            remapped = batch_remapped;
+            continue;
+        }
+
+        if (n == 0)
+            continue;
+
+        for (k = 0; k < n; ++k) {
+            map_copy_slot(k, pfn[k]);
+            flush_tlb((RCS421RegVal)COPY_SLOT(k));
+        }
+
+        for (k = 0; k < n; ++k) {
+            if (to_remote)
+                memcpy((char *)COPY_SLOT(k) + offset[k], local_at[k], size[k]);
+            else
+                memcpy(local_at[k], (char *)COPY_SLOT(k) + offset[k], size[k]);
+        }
+        copied += n;
+    }
+
+    TracePrintf(1, "COPY: %d pages remapped, %d pieces copied\n",
+        remapped, copied);
+
+    return 0;
+}
+
+/*
+ * Implements the Register() kernel call.
+ *
+ * Registers the calling process as the server for the given index.
+ *
+ * Returns ERROR if the index is invalid or already registered,
+ * 0 otherwise.
+ */
+int KernelRegister(unsigned int index) {
+    TracePrintf(0, "REGISTER: pid = %d, index = %u\n",
+        active_process->pid, index);
+
+    if (index == 0 || index > MAX_SERVER_INDEX
+        || services[index].server != NULL)
+        return ERROR;
+
+    services[index].server = active_process;
+    active_process->services |= 1 << index;
+
+    return 0;
+}
+
+/*
+ * Implements the Send() kernel call.
+ *
+ * Sends the MESSAGE_SIZE byte message msg to the process pid, or to
+ * the server registered at index -pid, and blocks until it replies.
+ * If the receiver is already waiting for the message, the kernel
+ * switches directly to it.
+ *
+ * On success the reply overwrites msg and 0 is returned. Returns
+ * ERROR if the receiver does not exist or exits before replying.
+ */
+int KernelSend(void *msg, int pid) {
+    struct process_info *dest;
+    struct message_queue *queue = find_queue(pid, &dest);
+
+    TracePrintf(1, "SEND: pid = %d, to = %d\n", active_process->pid, pid);
+
+    if (queue == NULL || dest == active_process
+        || fault_in_pages(msg, MESSAGE_SIZE, 0) == ERROR)
+        return ERROR;
+
+    memcpy(active_process->msg, msg, MESSAGE_SIZE);
+
+    if (queue_message(active_process, queue, dest)) {
+        // Hand the rest of the time slice straight to the receiver
+        last_switch = clock_count;
+        ContextSwitch(ContextSwitchFunc, &active_process->ctx,
+            (void *)active_process, (void *)dest);
+    } else
+        RemoveSwitch();
+
+    // The server may have shared pages with us through CopyTo, so the
+    // buffer may have become copy-on-write while we were blocked
+    if (active_process->msg_result == ERROR
+        || fault_in_pages(msg, MESSAGE_SIZE, 1) == ERROR)
+        return ERROR;
+
+    memcpy(msg, active_process->msg, MESSAGE_SIZE);
+
+    return 0;
+}
+
+/*
+ * Implements the Receive() kernel call.
+ *
+ * Blocks until a message is sent to the calling process, and
+ * copies it into msg.
+ *
+ * Returns the pid of the sender, or ERROR on failure.
+ */
+int KernelReceive(void *msg) {
+    TracePrintf(1, "RECEIVE: pid = %d\n", active_process->pid);
+
+    return receive_message(msg, 0);
+}
+
+/*
+ * Implements the ReceiveSpecific() kernel call.
+ *
+ * Like Receive, but only accepts a message from the process pid.
+ *
+ * Returns pid, or ERROR if pid does not exist or exits first.
+ */
+int KernelReceiveSpecific(void *msg, int pid) {
+    TracePrintf(1, "RECEIVE: pid = %d, from = %d\n", active_process->pid, pid);
+
+    if (pid <= 0 || pid == active_process->pid)
+        return ERROR;
+
+    return receive_message(msg, pid);
+}
+
+/*
+ * Implements the Reply() kernel call.
+ *
+ * Sends the reply msg to the process pid, whose message the caller
+ * has received, and unblocks it.
+ *
+ * Returns 0 on success, ERROR on failure.
+ */
+int KernelReply(void *msg, int pid) {
+    struct process_info *sender = find_replier(pid);
+
+    TracePrintf(1, "REPLY: pid = %d, to = %d\n", active_process->pid, pid);
+
+    if (sender == NULL || fault_in_pages(msg, MESSAGE_SIZE, 0) == ERROR)
+        return ERROR;
+
+    memcpy(sender->msg, msg, MESSAGE_SIZE);
+    wake_sender(sender, 0);
+
+    return 0;
+}
+
+/*
+ * Implements the Forward() kernel call.
+ *
+ * Sends msg to dst on behalf of src, whose message the caller has
+ * received. src stays blocked until dst replies to it.
+ *
+ * Returns 0 on success, ERROR on failure.
+ */
+int KernelForward(void *msg, int dst, int src) {
+    struct process_info *sender = find_replier(src);
+    struct process_info *dest;
+    struct message_queue *queue = find_queue(dst, &dest);
+
+    TracePrintf(1, "FORWARD: pid = %d, from = %d, to = %d\n",
+        active_process->pid, src, dst);
+
+    if (sender == NULL || queue == NULL || dest == sender
+        || fault_in_pages(msg, MESSAGE_SIZE, 0) == ERROR)
+        return ERROR;
+
+    memcpy(sender->msg, msg, MESSAGE_SIZE);
+
+    if (queue_message(sender, queue, dest))
+        push_process(&process_queue, &pq_tail, dest);
+
+    return 0;
+}
+
+/*
+ * Implements the CopyFrom() kernel call.
+ *
+ * Copies len bytes from address src of the process src_pid to
+ * address dest of the caller. src_pid must be blocked waiting for
+ * a Reply from the caller.
+ *
+ * Returns 0 on success, ERROR on failure.
+ */
+int KernelCopyFrom(int src_pid, void *dest, void *src, int len) {
+    TracePrintf(1, "COPYFROM: pid = %d, from = %d, len = %d\n",
+        active_process->pid, src_pid, len);
+
+    return copy_message_data(src_pid, dest, src, len, 0);
+}
+
+/*
+ * Implements the CopyTo() kernel call.
+ *
+ * Copies len bytes from address src of the caller to address dest
+ * of the process dst_pid. dst_pid must be blocked waiting for a
+ * Reply from the caller.
+ *
+ * Returns 0 on success, ERROR on failure.
+ */
+int KernelCopyTo(int dst_pid, void *dest, void *src, int len) {
+    TracePrintf(1, "COPYTO: pid = %d, to = %d, len = %d\n",
+        active_process->pid, dst_pid, len);
+
+    return copy_message_data(dst_pid, src, dest, len, 1);
+}
+
+/*
+ * Releases the IPC state of an exiting process. Its server
+ * registrations are dropped, any process blocked sending to it
+ * returns ERROR, and any process waiting in ReceiveSpecific for it
+ * is woken so that its call fails.
+ */
+void ipc_exit(struct process_info *pcb) {
+    unsigned int index;
+    struct process_info *p;
+    struct active_process *head;
+    struct message_queue *queue;
+
+    for (index = 1; pcb->services >> index; ++index) {
+        if (!(pcb->services & (1 << index)))
+            continue;
+
+        queue = &services[index].messages;
+        while ((p = pop_process(&queue->head, &queue->tail)) != NULL)
+            wake_sender(p, ERROR);
+
+        services[index].server = NULL;
+    }
+    pcb->services = 0;
+
+    queue = &pcb->messages;
+    while ((p = pop_process(&queue->head, &queue->tail)) != NULL)
+        wake_sender(p, ERROR);
+
+    for (head = all_processes; head != NULL; head = head->next) {
+        p = head->pcb;
+
+        if (p->msg_state == IPC_REPLY_BLOCKED && p->msg_dest == pcb->pid)
+            wake_sender(p, ERROR);
+        else if (p->msg_state == IPC_RECEIVE_BLOCKED
+            && p->receive_from == pcb->pid) {
+            p->msg_state = IPC_NONE;
+            push_process(&process_queue, &pq_tail, p);
+        }
+    }
+}
@@ -0,0 +1,151 @@
+#include <stdlib.h>
+#include <comp421/hardware.h>
+#include <comp421/yalnix.h>
+
+/*
+ * CopyFrom/CopyTo throughput benchmark.
+ *
+ * A child server copies a buffer into, or out of, its parent with
+ * CopyTo or CopyFrom for transfer sizes from 1 KB to 1 MB. Each size
+ * is run with page-aligned buffers, which the kernel can remap, and
+ * with buffers offset by a few bytes, which it has to copy.
+ *
+ * Usage: ipc_copybench [tick_ms]
+ *
+ * tick_ms is the length of a clock tick, used to convert the time
+ * measured in ticks to KB per second. Needs about 3 MB of physical
+ * memory.
+ */
+
+#define DEFAULT_TICK_MS 10
+#define MAX_SIZE        (1 << 20)
+#define MISALIGN        8
+
+// Clock ticks each size and mode is run for
+#define RUN_TICKS       50
+
+#define OP_READ     1   // Server copies its buffer to the client
+#define OP_WRITE    2   // Server copies the client buffer to itself
+#define OP_STOP     3
+
+struct request {
+    int op;
+    int len;
+    char *buf;
+    int misaligned;
+};
+
+union message {
+    struct request req;
+    char raw[MESSAGE_SIZE];
+};
+
+static char *
+aligned_buffer(void)
+{
+    char *p = malloc(MAX_SIZE + PAGESIZE + MISALIGN);
+
+    if (p == NULL)
+        return NULL;
+    return (char *)UP_TO_PAGE(p);
+}
+
+static void
+server(void)
+{
+    union message msg;
+    char *buf = aligned_buffer();
+    char *src;
+    int i, sender, op;
+
+    if (buf == NULL)
+        Exit(ERROR);
+
+    for (i = 0; i < MAX_SIZE + MISALIGN; ++i)
+        buf[i] = (char)i;
+
+    while (1) {
+        if ((sender = Receive(&msg)) == ERROR)
+            Exit(ERROR);
+
+        op = msg.req.op;
+        src = buf + (msg.req.misaligned ? MISALIGN : 0);
+        if (op == OP_READ)
+            msg.req.op = CopyTo(sender, msg.req.buf, src, msg.req.len);
+        else if (op == OP_WRITE)
+            msg.req.op = CopyFrom(sender, src, msg.req.buf, msg.req.len);
+        else
+            msg.req.op = 0;
+
+        Reply(&msg, sender);
+
+        if (op == OP_STOP)
+            Exit(0);
+    }
+}
+
+static void
+run(int pid, char *buf, int op, int len, int misaligned, int tick_ms)
+{
+    union message msg;
+    int start, ticks;
+    int kbytes = 0;
+
+    start = GetTicks();
+    while ((ticks = GetTicks() - start) < RUN_TICKS) {
+        msg.req = (struct request) {
+            .op = op,
+            .len = len,
+            .buf = buf + (misaligned ? MISALIGN : 0),
+            .misaligned = misaligned
+        };
+        if (Send(&msg, pid) == ERROR || msg.req.op == ERROR) {
+            TracePrintf(0, "ipc_copybench: transfer of %d bytes failed\n", len);
+            Exit(ERROR);
+        }
+        kbytes += len >> 10;
+    }
+
+    // Check the data actually arrived
+    if (op == OP_READ && buf[(misaligned ? MISALIGN : 0) + len - 1]
+        != (char)(len - 1 + (misaligned ? MISALIGN : 0)))
+        TracePrintf(0, "ipc_copybench: bad data after %d byte read\n", len);
+
+    TracePrintf(0, "ipc_copybench: %-8s %-9s %8d bytes %8d KB/s\n",
+        op == OP_READ ? "CopyTo" : "CopyFrom",
+        misaligned ? "unaligned" : "aligned", len,
+        kbytes / ticks * (1000 / tick_ms));
+}
+
+int
+main(int argc, char **argv)
+{
+    int tick_ms = argc > 1 ? atoi(argv[1]) : DEFAULT_TICK_MS;
+    union message msg;
+    char *buf;
+    int pid, len, status, i;
+
+    pid = Fork();
+    if (pid == 0)
+        server();
+
+    if ((buf = aligned_buffer()) == NULL) {
+        TracePrintf(0, "ipc_copybench: out of memory\n");
+        Exit(ERROR);
+    }
+    for (i = 0; i < MAX_SIZE + MISALIGN; ++i)
+        buf[i] = 0;
+
+    for (len = 1 << 10; len <= MAX_SIZE; len <<= 2) {
+        run(pid, buf, OP_READ, len, 0, tick_ms);
+        run(pid, buf, OP_READ, len, 1, tick_ms);
+        run(pid, buf, OP_WRITE, len, 0, tick_ms);
+        run(pid, buf, OP_WRITE, len, 1, tick_ms);
+    }
+
+    msg.req.op = OP_STOP;
+    Send(&msg, pid);
+    Wait(&status);
+
+    Exit(0);
+}
@@ -0,0 +1,68 @@
+#include <stdlib.h>
+#include <comp421/hardware.h>
+#include <comp421/yalnix.h>
+
+/*
+ * IPC ping-pong benchmark.
+ *
+ * A child process echoes messages back to its parent, which times
+ * a number of Send/Receive/Reply round trips.
+ *
+ * Usage: ipc_pingpong [rounds] [tick_ms]
+ *
+ * tick_ms is the length of a clock tick, used to convert the time
+ * measured in ticks to round trips per second.
+ */
+
+#define DEFAULT_ROUNDS  10000
+#define DEFAULT_TICK_MS 10
+
+int
+main(int argc, char **argv)
+{
+    int msg[MESSAGE_SIZE / sizeof(int)];
+    int rounds = argc > 1 ? atoi(argv[1]) : DEFAULT_ROUNDS;
+    int tick_ms = argc > 2 ? atoi(argv[2]) : DEFAULT_TICK_MS;
+    int i, pid, sender, start, ticks, status;
+
+    pid = Fork();
+    if (pid == 0) {
+        // Echo server: increment the counter and reply, until told to stop
+        while (1) {
+            if ((sender = Receive(msg)) == ERROR)
+                Exit(ERROR);
+            ++msg[0];
+            Reply(msg, sender);
+            if (msg[1])
+                Exit(0);
+        }
+    }
+
+    msg[0] = 0;
+    msg[1] = 0;
+
+    start = GetTicks();
+    for (i = 0; i < rounds; ++i) {
+        if (Send(msg, pid) == ERROR) {
+            TracePrintf(0, "ipc_pingpong: Send failed after %d rounds\n", i);
+            Exit(ERROR);
+        }
+    }
+    ticks = GetTicks() - start;
+
+    // Stop the server
+    msg[1] = 1;
+    Send(msg, pid);
+    Wait(&status);
+
+    if (msg[0] != rounds + 1)
+        TracePrintf(0, "ipc_pingpong: expected %d replies, got %d\n",
+            rounds + 1, msg[0]);
+
+    TracePrintf(0, "ipc_pingpong: %d round trips in %d ticks\n", rounds, ticks);
+    if (ticks > 0)
+        TracePrintf(0, "ipc_pingpong: %d round trips per second\n",
+            rounds * (1000 / tick_ms) / ticks);
+
+    Exit(0);
+}
@@ -0,0 +1,160 @@
+#include <comp421/hardware.h>
+#include <comp421/yalnix.h>
+
+/*
+ * Server registry test.
+ *
+ * NUM_SERVERS servers each register two of the MAX_SERVER_INDEX
+ * service indexes, so every server receives from several queues.
+ * NUM_CLIENTS clients, started WAVE at a time, send requests to all
+ * of the services and check that each request was answered by the
+ * server owning its index. At the end of each wave the parent
+ * collects a report from each client with ReceiveSpecific, in the
+ * reverse of the order they were started.
+ */
+
+#define NUM_SERVERS     (MAX_SERVER_INDEX / 2)
+#define NUM_CLIENTS     320
+#define WAVE            32
+#define REQUESTS        8
+
+#define OP_READY    1
+#define OP_REQUEST  2
+#define OP_REPORT   3
+#define OP_STOP     4
+
+struct message {
+    int op;
+    int index;
+    int value;
+    int errors;
+    char pad[MESSAGE_SIZE - 4 * sizeof(int)];
+};
+
+/*
+ * Services index and index + NUM_SERVERS belong to the same server.
+ */
+static int
+owner(int index)
+{
+    return (index - 1) % NUM_SERVERS;
+}
+
+static void
+server(int parent, int n)
+{
+    struct message msg;
+    int sender, stops = 0;
+
+    if (Register(n + 1) == ERROR || Register(n + 1 + NUM_SERVERS) == ERROR)
+        Exit(ERROR);
+
+    msg.op = OP_READY;
+    Send(&msg, parent);
+
+    while (stops < 2) {
+        if ((sender = Receive(&msg)) == ERROR)
+            Exit(ERROR);
+
+        if (msg.op == OP_STOP)
+            ++stops;
+        else if (msg.op != OP_REQUEST || owner(msg.index) != n)
+            msg.value = ERROR;
+        else
+            msg.value = 2 * msg.value + msg.index;
+
+        Reply(&msg, sender);
+    }
+
+    Exit(0);
+}
+
+static void
+client(int parent, int id)
+{
+    struct message msg;
+    int i, value, errors = 0;
+
+    for (i = 0; i < REQUESTS; ++i) {
+        value = id * REQUESTS + i;
+        msg.op = OP_REQUEST;
+        msg.index = (id + i) % MAX_SERVER_INDEX + 1;
+        msg.value = value;
+
+        if (Send(&msg, -msg.index) == ERROR
+            || msg.value != 2 * value + msg.index)
+            ++errors;
+    }
+
+    msg.op = OP_REPORT;
+    msg.errors = errors;
+    Send(&msg, parent);
+
+    Exit(0);
+}
+
+int
+main()
+{
+    struct message msg;
+    int parent = GetPid();
+    int pids[WAVE];
+    int i, n, id, status, sender;
+    int errors = 0, start = GetTicks();
+
+    for (n = 0; n < NUM_SERVERS; ++n) {
+        if (Fork() == 0)
+            server(parent, n);
+    }
+
+    // Wait for every server to register
+    for (n = 0; n < NUM_SERVERS; ++n) {
+        if ((sender = Receive(&msg)) == ERROR || msg.op != OP_READY)
+            ++errors;
+        Reply(&msg, sender);
+    }
+
+    if (Register(1) != ERROR) {
+        TracePrintf(0, "ipc_registry_test: registered a taken index\n");
+        ++errors;
+    }
+
+    for (id = 0; id < NUM_CLIENTS; id += WAVE) {
+        for (i = 0; i < WAVE; ++i) {
+            if ((pids[i] = Fork()) == 0)
+                client(parent, id + i);
+        }
+
+        for (i = WAVE - 1; i >= 0; --i) {
+            if (ReceiveSpecific(&msg, pids[i]) != pids[i]
+                || msg.op != OP_REPORT) {
+                TracePrintf(0, "ipc_registry_test: no report from %d\n",
+                    pids[i]);
+                ++errors;
+            } else
+                errors += msg.errors;
+            Reply(&msg, pids[i]);
+        }
+
+        for (i = 0; i < WAVE; ++i)
+            Wait(&status);
+    }
+
+    for (i = 1; i <= MAX_SERVER_INDEX; ++i) {
+        msg.op = OP_STOP;
+        Send(&msg, -i);
+    }
+    for (n = 0; n < NUM_SERVERS; ++n)
+        Wait(&status);
+
+    if (Send(&msg, -1) != ERROR) {
+        TracePrintf(0, "ipc_registry_test: sent to an exited server\n");
+        ++errors;
+    }
+
+    TracePrintf(0, "ipc_registry_test: %d services, %d clients, %d requests "
+        "in %d ticks, %d errors\n", MAX_SERVER_INDEX, NUM_CLIENTS,
+        NUM_CLIENTS * REQUESTS, GetTicks() - start, errors);
+
+    Exit(errors ? ERROR : 0);
+}
@@ -8,14 +8,158 @@
 #include <stddef.h>
 #include <stdio.h>
 
-#define NUM_RESERVED_KERNEL_PAGES   3
+#include "trace.h"
 
-#define CURRENT_PAGE_TABLE          ((struct pte *)(VMEM_LIMIT - PAGESIZE))
+// Window at the top of region 1 in which every region 0 page table
+// stays mapped, TABLES_PER_PAGE to a page. KernelStart sizes it to
+// pt_window_pages pages from the amount of physical memory, up to
+// PT_WINDOW_MAX_PAGES. Table 0 is the idle page table and table 1 init's.
+#define PT_WINDOW_MAX_PAGES         (PAGE_TABLE_LEN / 2)
+#define TABLES_PER_PAGE             (PAGESIZE / PAGE_TABLE_SIZE)
+#define PT_WINDOW_INDEX(k)          (PAGE_TABLE_LEN - 1 - (k))
+#define PT_WINDOW_SLOT(k)           ((struct pte *)(VMEM_1_LIMIT - ((k) + 1) * PAGESIZE))
+#define PT_WINDOW_TABLE(t)          (PT_WINDOW_SLOT((t) / TABLES_PER_PAGE) + ((t) % TABLES_PER_PAGE) * PAGE_TABLE_LEN)
+
+// Region 1 pages below the window used to map other frames when copying
+#define NUM_COPY_SLOTS              8
+#define COPY_SLOT_INDEX(k)          (PAGE_TABLE_LEN - pt_window_pages - 1 - (k))
+#define COPY_SLOT(k)                ((void *)(VMEM_1_LIMIT - (pt_window_pages + 1 + (k)) * PAGESIZE))
+
+#define NUM_RESERVED_KERNEL_PAGES   (pt_window_pages + NUM_COPY_SLOTS)
+
+#define CURRENT_PAGE_TABLE          (active_process->pt_vaddr)
+
+// Set in the unused bits of a read-only pte whose frame is shared, and
+// which is given a private copy of the frame on the first write to it
+#define PTE_COPY_ON_WRITE           0b00001
+
+// Set in the unused bits of a valid user pte whose user access the
+// pageout clock has taken away, to see whether the page is used again.
+// kprot always holds the real protection of a user page.
+#define PTE_UNREFERENCED            0b00010
+
+// Set in the unused bits of an invalid user pte whose page has been
+// paged out to the swap slot held in its pfn
+#define PTE_SWAPPED                 0b00100
+
+// Set on a user pte which maps a page of a shared memory segment
+#define PTE_SHARED                  0b01000
+
+// A user pte which holds a page, in memory or in swap
+#define USER_PAGE_MAPPED(pte)       ((pte)->valid || ((pte)->unused & PTE_SWAPPED))
 
 #define MAX_CLOCK_TICKS 2
 
+// Number of pages the user stack grows by on each stack fault
+#define STACK_GROW_PAGES    4
+
 #define NO_PARENT   -1
 
+// Number of buckets in the pid table
+#define PID_TABLE_SIZE      64
+
+// Disk scheduling policies
+#define DISK_FIFO           0
+#define DISK_CLOOK          1
+
+#ifndef DISK_POLICY
+#define DISK_POLICY         DISK_CLOOK
+#endif
+
+// Under C-LOOK, a request which has waited while this many others were
+// serviced is served next, so it cannot be starved. 0 disables aging.
+#ifndef DISK_DEADLINE
+#define DISK_DEADLINE       64
+#endif
+
+// Request latencies are counted up to this many disk operations
+#define DISK_LATENCY_BUCKETS    256
+
+// Number of sectors held by the buffer cache
+#ifndef CACHE_BLOCKS
+#define CACHE_BLOCKS        64
+#endif
+
+// Number of buckets in the buffer cache hash table
+#define CACHE_HASH_SIZE     64
+
+// Most sectors ReadSectors queues before waiting for any of them
+#define DISK_BATCH          (CACHE_BLOCKS / 2)
+
+// Sequential read-ahead starts with READAHEAD_MIN sectors, doubling for
+// each sequential read up to READAHEAD_MAX. 0 disables read-ahead.
+#ifndef READAHEAD_MAX
+#define READAHEAD_MAX       16
+#endif
+#define READAHEAD_MIN       2
+
+// Number of sequential read streams tracked at once
+#define READAHEAD_STREAMS   8
+
+// Number of entries in the kernel call dispatch table
+#define SYSCALL_TABLE_SIZE  64
+
+// Number of records in the trace ring buffer, a power of two.
+// 0 disables tracing.
+#ifndef TRACE_EVENTS
+#define TRACE_EVENTS        2048
+#endif
+
+// Logs an event in the trace ring, overwriting the oldest record
+#if TRACE_EVENTS > 0
+#define TRACE_EVENT(id, a0, a1) \
+    (trace_ring[trace_next++ & (TRACE_EVENTS - 1)] = (struct trace_event) { \
+        .time = clock_count, \
+        .event = (id), \
+        .pid = active_process == NULL ? -1 : active_process->pid, \
+        .arg0 = (unsigned int)(unsigned long)(a0), \
+        .arg1 = (unsigned int)(unsigned long)(a1) \
+    })
+#else
+#define TRACE_EVENT(id, a0, a1) ((void)0)
+#endif
+
+// Logs each interrupt to the TRACE file as a REPLAY line, which
+// hostsim -r can replay. Off by default, as each line is formatted in
+// the interrupt path; build with -DREPLAY_LOG=1 to record a run.
+#ifndef REPLAY_LOG
+#define REPLAY_LOG          0
+#endif
+
+// Clock tick samples the profiler keeps, and programs it can name
+#define PROFILE_SAMPLES     4096
+#define PROFILE_PROGRAMS    32
+
+// Programs PoolSpawn keeps loaded processes for, and how many of each
+#define POOL_PROGRAMS       4
+#define POOL_SIZE           2
+
+// Free pages the idle process leaves when refilling a pool
+#define POOL_RESERVE_PAGES  64
+
+// Free pages the idle process keeps cleared for alloc_zeroed_page
+#define ZEROED_PAGES        32
+
+// Shared memory segments which may exist at once, and the pages left
+// below the stack for it to grow into when placing an attachment
+#define SHM_SEGMENTS        32
+#define SHM_STACK_GAP       64
+
+// The swap area, one page per slot, in the sectors kept from users.
+// With no swap sectors nothing is ever paged out.
+#define SECTORS_PER_PAGE    (PAGESIZE / SECTORSIZE)
+#define SWAP_PAGES          (SWAP_SECTORS / SECTORS_PER_PAGE)
+
+// Free frames paging out tries to keep on top of what was asked for,
+// for the kernel heap and page tables
+#define PAGEOUT_FREE_FRAMES 4
+
+// IPC state of a process
+#define IPC_NONE            0
+#define IPC_SEND_BLOCKED    1   // Queued on the receiver, not yet received
+#define IPC_REPLY_BLOCKED   2   // Received, waiting for a Reply
+#define IPC_RECEIVE_BLOCKED 3   // Blocked in Receive or ReceiveSpecific
+
 
 // Struct definitions
 struct available_line {
@@ -39,24 +183,61 @@ struct terminal_info {
     struct available_line *last_line;
 };
 
+// Queue of processes whose messages wait to be received
+struct message_queue {
+    struct process_info *head;
+    struct process_info *tail;
+};
+
 struct process_info {
     unsigned int pid;
     unsigned int delay_ticks;
     void *page_table;
+    struct pte *pt_vaddr;       // Address of the page table in the PT window
     unsigned int user_pages;    // Number of allocated pages (excluding kernel stack)
     SavedContext ctx;
     void *user_brk;
+    unsigned int heap_reserved; // Heap pages reserved by Brk but not yet backed
+    void *stack_base;           // Lowest mapped address of the user stack
+    unsigned int stack_faults;  // Number of faults which grew the stack
     unsigned int parent;
     int active_children;
     int exited_children;
+    int waiting_child;          // Blocked in Wait until a child exits
     struct process_info *next_process;
     struct process_info *prev_process;
     struct available_line *line;
     int seeking_len;
+    char msg[MESSAGE_SIZE];     // Message being sent, then the reply to it
+    int msg_state;              // One of the IPC_* states
+    int msg_result;             // Value returned by a blocked Send
+    unsigned int msg_dest;      // Process a sent message is addressed to
+    int receive_from;           // Sender awaited by ReceiveSpecific, 0 for any
+    struct message_queue *msg_queue;    // Queue our message waits in
+    unsigned int msg_seq;       // When our message was sent
+    struct message_queue messages;      // Messages sent to our pid
+    unsigned int services;      // Bitmask of server indexes we registered
+    struct process_info *pid_next;      // Next process in the pid table bucket
+    unsigned int ticks_run;     // Clock ticks spent running
+    unsigned int ticks_ready;   // Clock ticks spent on the ready queue
+    unsigned int ready_since;   // clock_count when put on the ready queue
+    unsigned int switches;      // Times switched away from
+    unsigned int preemptions;   // Switches forced by the clock
+    unsigned int page_faults;   // TRAP_MEMORY exceptions taken
+    unsigned int tty_in;        // Bytes read from terminals
+    unsigned int tty_out;       // Bytes written to terminals
+    unsigned int syscalls;      // Kernel calls made
+    int program;                // Index in profile_programs of our program
+    struct process_pool *pool;  // Pool we are loaded for, until handed out
+    char **spawn_args;          // Arguments PoolSpawn handed us out with
+    struct shm_attachment *shm; // Shared memory segments we have attached
 };
 
 struct free_page {
     char in_use;
+    char zeroed;                // Free, cleared, and on zeroed_list
+    unsigned int refs;          // Number of user ptes mapping the frame
+    struct free_page *next_zeroed;
 };
 
 struct exit_status {
@@ -67,6 +248,72 @@ struct exit_status {
     struct exit_status *next;
 };
 
+struct syscall_entry {
+    int (*handler)(ExceptionInfo *);
+    char *name;
+    unsigned int calls;         // Number of times called
+    unsigned int ticks;         // Total clock ticks spent in the call
+};
+
+struct service {
+    struct process_info *server;        // Registered server, or NULL
+    struct message_queue messages;      // Messages sent to the index
+};
+
+struct cache_block {
+    int sector;                 // Sector cached, or -1
+    char data[SECTORSIZE];      // Region 1 buffer the disk transfers
+    int valid;                  // data holds the sector's contents
+    int dirty;                  // data is newer than the disk
+    int busy;                   // Queued for, or being serviced by, the disk
+    int prefetched;             // Read ahead, and not yet read by anyone
+    int op;                     // DISK_READ or DISK_WRITE while busy
+    unsigned int submitted;     // Value of disk_ops_done when queued
+    struct process_info *waiters;       // Processes blocked until not busy
+    struct process_info *waiters_tail;
+    struct cache_block *next;           // Next in the disk queue
+    struct cache_block *hash_next;
+    struct cache_block *lru_prev;       // More recently used block
+    struct cache_block *lru_next;       // Less recently used block
+};
+
+struct profile_sample {
+    unsigned long pc;
+    short pid;
+    char program;               // Index in profile_programs, 0 if unknown
+    char kernel;                // Taken in kernel mode
+};
+
+struct process_pool {
+    char *name;                 // Program, NULL if the slot is unused
+    struct process_info *parked;        // Loaded, waiting to be handed out
+    struct process_info *parked_tail;
+    int count;                  // Processes parked
+    int loading;                // Processes still loading the program
+    int failed;                 // The program would not load
+};
+
+struct shm_segment {
+    int id;                     // 0 if the slot is unused
+    unsigned int creator;       // Pid keeping the segment, 0 once it let go
+    int npages;
+    unsigned int *pfns;         // Frames, each holding a ref of the segment
+    int attaches;               // Attachments in all processes
+};
+
+struct shm_attachment {
+    struct shm_segment *segment;
+    unsigned int vpn;           // First page the segment is mapped at
+    struct shm_attachment *next;
+};
+
+struct readahead_stream {
+    int next;                   // Sector expected to be read next
+    int window;                 // Sectors to keep read ahead of next
+    int end;                    // First sector not yet read ahead
+    unsigned int used;          // Time of last use, 0 if never used
+};
+
 struct active_process {
     unsigned int pid;
     struct process_info *pcb;
@@ -78,11 +325,33 @@ struct terminal_info *terminals[NUM_TERMINALS];
 
 struct active_process *all_processes;
 
+// Processes other than idle which are runnable or blocked, that is not
+// parked in a pool; the kernel halts once none is left
+unsigned int live_processes;
+
 // Util function definitions
-extern struct pte *get_new_page_table(void);
-extern void free_page_table(struct pte *pt);
+extern int get_new_page_table(struct process_info *pcb);
+extern void free_page_table(struct process_info *pcb);
 extern unsigned int alloc_page(void);
+extern unsigned int alloc_zeroed_page(void);
+extern void zero_free_pages(void);
 extern int free_page(int pfn);
+extern void free_user_page(struct pte *pte);
+extern int alloc_heap_page(struct process_info *pcb, unsigned int vpn,
+    int write);
+extern void map_zero_page(struct pte *pte);
+extern int copy_on_write(struct process_info *pcb, unsigned int vpn);
+extern int fault_in_pages(void *addr, int len, int write);
+extern int grow_user_stack(void *addr);
+extern void copy_pages(struct pte *dst_table, int first, int last);
+extern void map_copy_slot(int k, unsigned int pfn);
+extern void flush_tlb(RCS421RegVal addr);
+extern void kernel_halt(void);
+extern void trace_dump(void);
+extern void record_trap(ExceptionInfo *info);
+extern struct process_info *find_process(int pid);
+extern void insert_pid(struct process_info *pcb);
+extern void remove_pid(struct process_info *pcb);
 
 extern void push_process(struct process_info **head, struct process_info **tail,
     struct process_info *new_pcb);
@@ -96,16 +365,72 @@ extern SavedContext *ContextSwitchFunc(SavedContext *, void *, void *);
 extern SavedContext *ContextSwitchForkHelper(SavedContext *, void *, void *);
 extern SavedContext *ContextSwitchInitHelper(SavedContext *, void *, void *);
 extern SavedContext *ContextSwitchExitHelper(SavedContext *, void *, void *);
+extern void load_page_table(struct process_info *pcb);
+extern void RemoveSwitch(void);
 
 // Kernel Call function definitions
 extern int KernelFork(void);
 extern void KernelExec(ExceptionInfo *info);
+extern int KernelSpawn(char *name, char **argv, ExceptionInfo *info);
+extern struct process_info *new_process(unsigned int parent);
+extern char *copy_user_string(char *s);
+extern char **copy_user_args(char **argv);
+extern void free_args(char **args);
 extern void KernelExit(int status);
 extern int KernelWait(int *status_ptr);
 extern int KernelBrk(void *addr);
 extern int KernelDelay(int clock_ticks);
 extern int KernelTtyRead(int tty_id, void *buf, int len);
 extern int KernelTtyWrite(int tty_id, void *buf, int len);
+extern int KernelGetStats(int pid, struct procstats *stats);
+
+// Profiler function definitions
+extern int KernelProfile(int op);
+extern int profile_program(char *name);
+extern void profile_tick(ExceptionInfo *info);
+extern void profile_dump(void);
+
+// Process pool function definitions
+extern int KernelPoolSpawn(char *name, char **argv, ExceptionInfo *info);
+extern void pool_refill(ExceptionInfo *info);
+
+// Shared memory function definitions
+extern int KernelShmCreate(int size);
+extern int KernelShmAttach(int id);
+extern int KernelShmDetach(void *addr);
+extern void shm_fork(struct process_info *parent, struct process_info *child);
+extern void shm_release(struct process_info *pcb);
+extern long heap_ceiling(struct process_info *pcb);
+extern long stack_floor(struct process_info *pcb);
+
+// Swap function definitions
+extern int available_pages(void);
+extern int reserve_frames(int n);
+extern int page_out(void);
+extern int swap_in(struct process_info *pcb, unsigned int vpn);
+extern void free_swap_slot(unsigned int slot);
+extern int resident_pages(struct process_info *pcb);
+
+// IPC function definitions
+extern int KernelRegister(unsigned int index);
+extern int KernelSend(void *msg, int pid);
+extern int KernelReceive(void *msg);
+extern int KernelReceiveSpecific(void *msg, int pid);
+extern int KernelReply(void *msg, int pid);
+extern int KernelForward(void *msg, int dst, int src);
+extern int KernelCopyFrom(int src_pid, void *dest, void *src, int len);
+extern int KernelCopyTo(int dst_pid, void *dest, void *src, int len);
+extern void ipc_exit(struct process_info *pcb);
+
+// Disk function definitions
+extern int KernelReadSector(int sector, void *buf);
+extern int KernelWriteSector(int sector, void *buf);
+extern int KernelDiskStats(struct diskstats *stats);
+extern int KernelDiskSync(void);
+extern int KernelReadSectors(int start, int count, void *buf);
+extern int KernelWriteSectors(int start, int count, void *buf);
+extern void disk_sync(void);
+extern void swap_io(int op, unsigned int slot, unsigned int pfn);
 
 // Load Program function definitions
 extern int LoadProgram(char *name, char **args, ExceptionInfo *info);
@@ -118,6 +443,8 @@ extern void trap_memory_handler(ExceptionInfo *exceptionInfo);
 extern void trap_math_handler(ExceptionInfo *exceptionInfo);
 extern void trap_tty_transmit_handler(ExceptionInfo *exceptionInfo);
 extern void trap_tty_receive_handler(ExceptionInfo *exceptionInfo);
+extern void trap_disk_handler(ExceptionInfo *exceptionInfo);
+extern void print_syscall_stats(void);
 
 
 
@@ -131,6 +458,9 @@ unsigned int tot_pmem_pages;
 void *cur_brk;
 
 char vmem_enabled;
+void *loaded_page_table;    // Region 0 page table currently in REG_PTR0
+int pt_window_pages;
+char pt_window_used[PT_WINDOW_MAX_PAGES * TABLES_PER_PAGE];
 
 
 struct pte kernel_page_table[PAGE_TABLE_LEN];
@@ -145,7 +475,66 @@ struct process_info *waiting_queue;
 struct process_info *wq_tail;
 
 int allocated_pages;
-
+int committed_pages;    // Pages promised to reserved heap and copy-on-write pages
+
+// Free pages already cleared by the idle process
+struct free_page *zeroed_list;
+unsigned int zeroed_pages;
+unsigned int zero_scan;         // Where zero_free_pages looks next
+unsigned int zeroed_hits;       // Zeroed pages taken from zeroed_list
+unsigned int zeroed_misses;     // Zeroed pages cleared on demand
+
+// Kernel-owned frame of zeros, mapped copy-on-write for untouched bss
+// pages. The kernel's reference keeps it from ever being freed.
+unsigned int zero_pfn;
+
+
+// Registered servers, indexed by server index
+struct service services[MAX_SERVER_INDEX + 1];
+unsigned int next_msg_seq;
+
+// Hash table of all processes, by pid
+struct process_info *pid_table[PID_TABLE_SIZE];
+
+// Cache blocks waiting for the disk, and the one it is servicing
+struct cache_block *disk_queue;
+struct cache_block *disk_queue_tail;
+struct cache_block *disk_active;
+struct diskstats disk_stats;
+
+// Sector buffer cache, hashed by sector and kept in LRU order
+struct cache_block *cache_table[CACHE_HASH_SIZE];
+struct cache_block *cache_lru;          // Most recently used block
+struct cache_block *cache_lru_tail;     // Least recently used block
+int cache_count;                        // Blocks allocated so far
+
+// Sequential reads being tracked for read-ahead
+struct readahead_stream readahead_streams[READAHEAD_STREAMS];
+unsigned int readahead_clock;
+
+// Disk scheduling state and statistics
+int disk_head_sector;           // Sector of the last request started
+unsigned int disk_ops_done;
+unsigned int disk_seek_total;
+unsigned int disk_depth_total;
+unsigned int disk_latency[DISK_LATENCY_BUCKETS];
+
+// Swap slots, by the number of ptes holding each, and the page of
+// blocks the disk transfers them through
+unsigned short swap_refs[SWAP_PAGES > 0 ? SWAP_PAGES : 1];
+unsigned int swapped_pages;     // Slots in use
+unsigned int swap_outs;         // Pages paged out so far
+unsigned int swap_ins;          // Pages read back so far
+struct cache_block swap_blocks[SECTORS_PER_PAGE];
+
+// Only one process may page at a time
+int swap_busy;
+struct process_info *swap_waiters;
+struct process_info *swap_waiters_tail;
+
+// Position of the pageout clock hand
+unsigned int clock_pid;
+unsigned int clock_vpn;
 
 struct exit_status *exit_queue;
 struct exit_status *eq_tail;
@@ -154,5 +543,34 @@ struct exit_status *eq_tail;
 unsigned int clock_count;
 unsigned int last_switch;
 
+// Trace ring buffer, and the number of events ever logged in it
+#if TRACE_EVENTS > 0
+struct trace_event trace_ring[TRACE_EVENTS];
+#endif
+unsigned int trace_next;
+
+// Kernel entries so far, which places each interrupt in the replay log
+unsigned int trap_count;
+
+// Profiler samples, and the programs they refer to
+int profiling;
+struct profile_sample profile_samples[PROFILE_SAMPLES];
+int profile_count;
+unsigned int profile_lost;              // Samples after the buffer filled
+char *profile_programs[PROFILE_PROGRAMS];
+int num_profile_programs;
+
+// Pools of loaded processes for PoolSpawn
+struct process_pool pools[POOL_PROGRAMS];
+
+// Shared memory segments, and the id the next one is given
+struct shm_segment shm_segments[SHM_SEGMENTS];
+int shm_next_id;
+
+// TLB statistics, reported when the kernel halts
+unsigned int switch_count;
+unsigned int switch_flushes;
+unsigned int tlb_flushes;
+
 
 #endif
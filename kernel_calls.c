@@ -1,8 +1,32 @@
 
+#include <fcntl.h>
+#include <unistd.h>
 #include <string.h>
+#include <stdlib.h>
 
 #include "kernel.h"
 
+/*
+ * Makes a newly built process runnable and adds it to the pid table
+ * and the list of all processes.
+ */
+static void add_process(struct process_info *pcb) {
+    push_process(&process_queue, &pq_tail, pcb);
+    insert_pid(pcb);
+    ++live_processes;
+
+    struct active_process *new_process = (struct active_process *)
+        malloc(sizeof(struct active_process));
+    *new_process = (struct active_process) {
+        .pid = pcb->pid,
+        .pcb = pcb,
+        .prev = NULL,
+        .next = all_processes
+    };
+    all_processes->prev = new_process;
+    all_processes = new_process;
+}
+
 /*
  * Implements the Fork() kernel call.
  *
@@ -20,29 +44,36 @@ int KernelFork(void) {
 
     TracePrintf(0, "FORK: pid = %d\n", active_process->pid);
 
-    // Check if there is sufficient physical memory to fork
-    if (active_process->user_pages + KERNEL_STACK_PAGES >
-    tot_pmem_pages - allocated_pages)
+    // Check if there is sufficient memory to fork, including memory
+    // for the heap pages the child inherits as reserved and for the
+    // page table
+    if (active_process->user_pages + KERNEL_STACK_PAGES + 1 +
+    active_process->heap_reserved > available_pages())
         return ERROR;
 
-    WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_1);
+    // Resident pages are copied now, so page out until they fit. Our
+    // own pages may go too, and the copy then shares their slots.
+    while (resident_pages(active_process) + KERNEL_STACK_PAGES + 1 >
+    tot_pmem_pages - allocated_pages) {
+        if (page_out() == ERROR)
+            return ERROR;
+    }
 
-    // Create new page table
-    struct pte *new_page_table = get_new_page_table();
+    // Create new pcb and page table
+    struct process_info *pcb = (struct process_info *)
+        malloc(sizeof(struct process_info));
 
-    TracePrintf(1, "FORK: New page table: %x, active page table: %x\n",
-        (unsigned int)new_page_table, (unsigned int)active_process->page_table);
+    if (pcb == NULL || get_new_page_table(pcb) == ERROR) {
+        free(pcb);
+        return ERROR;
+    }
 
-    // Ensure virtual memory mappings are correct
-    kernel_page_table[PAGE_TABLE_LEN - 1].pfn =
-        (unsigned int)(active_process->page_table) >> PAGESHIFT;
-    kernel_page_table[PAGE_TABLE_LEN - 2].pfn =
-        (unsigned int)(new_page_table) >> PAGESHIFT;
+    TracePrintf(1, "FORK: New page table: %x, active page table: %x\n",
+        (unsigned int)pcb->page_table, (unsigned int)active_process->page_table);
 
-    // Initialize pointers to the virtual addresses of the tables
-    struct pte *cur_table_base = (struct pte *)(VMEM_1_LIMIT - PAGESIZE);
-    struct pte *new_table_base = (struct pte *)(VMEM_1_LIMIT - 2 * PAGESIZE);
-    void *temp = (void *)(VMEM_1_LIMIT - 3 * PAGESIZE);
+    // Both tables are permanently mapped in the page table window
+    struct pte *cur_table_base = active_process->pt_vaddr;
+    struct pte *new_table_base = pcb->pt_vaddr;
 
     // Copy active page table to new page table
     memcpy((void *)new_table_base, (void *)cur_table_base,
@@ -50,14 +81,46 @@ int KernelFork(void) {
 
     // For every valid page, allocate a physical page and update the pfn
     for (i = 0; i < PAGE_TABLE_LEN; ++i) {
+        // The child shares the swap slot of a page in swap, and
+        // commits a page for reading it back
+        if ((new_table_base + i)->unused & PTE_SWAPPED) {
+            ++swap_refs[(new_table_base + i)->pfn];
+            ++committed_pages;
+
+            if ((new_table_base + i)->unused & PTE_COPY_ON_WRITE) {
+                (new_table_base + i)->unused = PTE_SWAPPED;
+                (new_table_base + i)->uprot = PROT_READ | PROT_WRITE;
+                (new_table_base + i)->kprot = PROT_READ | PROT_WRITE;
+            }
+            continue;
+        }
+
+        // Pages of shared memory segments are shared, not copied
+        if ((new_table_base + i)->unused & PTE_SHARED) {
+            ++(free_pages + (new_table_base + i)->pfn)->refs;
+            continue;
+        }
+
         if ((new_table_base + i)->valid == 1) {
+            // The child shares untouched pages of zeros too
+            if ((new_table_base + i)->pfn == zero_pfn) {
+                map_zero_page(new_table_base + i);
+                continue;
+            }
+
             if (((new_table_base + i)->pfn = alloc_page()) == ERROR) {
                 error = 1;
                 break;
             }
 
-            TracePrintf(1, "FORK: Assigned physical page %d to virtual page %d\n",
-                        (new_table_base + i)->pfn, i);
+            // The child's copy of a shared page is its own
+            if ((new_table_base + i)->unused & PTE_COPY_ON_WRITE) {
+                (new_table_base + i)->unused = 0;
+                (new_table_base + i)->uprot = PROT_READ | PROT_WRITE;
+                (new_table_base + i)->kprot = PROT_READ | PROT_WRITE;
+            }
+
+            TRACE_EVENT(TRACE_FORK_PAGE, i, (new_table_base + i)->pfn);
         }
     }
 
@@ -65,72 +128,49 @@ int KernelFork(void) {
     if (error) {
         // Free any physical pages which were allocated
         for (j = 0; j < i; ++j) {
-            if ((new_table_base + j)->valid == 1)
-                free_page((new_table_base + i)->pfn);
+            if (USER_PAGE_MAPPED(new_table_base + j))
+                free_user_page(new_table_base + j);
         }
 
-        free_page_table(new_page_table);
+        free_page_table(pcb);
+        free(pcb);
 
         return ERROR;
     }
 
 
     // Copy the old memory to the new memory, excluding kernel stack
-    for (i = 0; i < PAGE_TABLE_LEN - KERNEL_STACK_PAGES; ++i) {
+    copy_pages(new_table_base, 0, PAGE_TABLE_LEN - KERNEL_STACK_PAGES);
 
-        if ((new_table_base + i)->valid == 1) {
-            TracePrintf(1, "FORK: Copying page %d, new_table_base = %x, pfn = %d, src_addr = %x, valid = %d\n",
-                i, (unsigned int)new_table_base, (new_table_base + i)->pfn,
-                        VMEM_0_BASE + i * PAGESIZE, (new_table_base + i)->valid);
-
-            // Point temp to the new physical page
-            kernel_page_table[PAGE_TABLE_LEN - 3].pfn =
-                (new_table_base + i)->pfn;
-
-            // Clear temp from TLB
-            WriteRegister(REG_TLB_FLUSH, (RCS421RegVal)temp);
+    ++(active_process->active_children);
 
-            // Copy page from region 0 into temp (new physical page)
-            TracePrintf(1, "FORK: Calling memcpy, %x, %x\n", (unsigned int)temp,
-                        (unsigned int)(VMEM_0_BASE + i * PAGESIZE));
-            memcpy(temp, (const void *)(VMEM_0_BASE + i * PAGESIZE), PAGESIZE);
-        }
-    }
+    // The child holds its own reservation for unbacked heap pages
+    committed_pages += active_process->heap_reserved;
 
-    ++(active_process->active_children);
-    
     TracePrintf(1, "FORK: Setting up PCB\n");
-    // Create new pcb and add it to the process queue
-    struct process_info *pcb = (struct process_info *)
-        malloc(sizeof(struct process_info));
-
+    // Fill in the new pcb and add it to the process queue
     *pcb = (struct process_info) {
         .pid = next_pid++,
-        .page_table = (void *)new_page_table,
+        .page_table = pcb->page_table,
+        .pt_vaddr = pcb->pt_vaddr,
         .user_pages = active_process->user_pages,
         .user_brk = active_process->user_brk,
+        .heap_reserved = active_process->heap_reserved,
+        .stack_base = active_process->stack_base,
+        .program = active_process->program,
         .parent = pid,
         .active_children = 0,
         .exited_children = 0
     };
 
-    TracePrintf(1, "FORK: Adding PCB to queue\n");
-    push_process(&process_queue, &pq_tail, pcb);
+    // The child is attached to the same shared memory segments
+    shm_fork(active_process, pcb);
 
-    // Add process to list of all processes
-    struct active_process *new_process = (struct active_process *)
-        malloc(sizeof(struct active_process));
-    *new_process = (struct active_process) {
-        .pid = pcb->pid,
-        .pcb = pcb,
-        .prev = NULL,
-        .next = all_processes
-    };
-    all_processes->prev = new_process;
-    all_processes = new_process;
+    TracePrintf(1, "FORK: Adding PCB to queue\n");
+    add_process(pcb);
 
     // Use context switch to get context for child process
-    ContextSwitch(ContextSwitchForkHelper, &(pcb->ctx), NULL, NULL);
+    ContextSwitch(ContextSwitchForkHelper, &(pcb->ctx), pcb, NULL);
 
 
     // Return 0 if in child process, new pid otherwise
@@ -157,16 +197,28 @@ void KernelExec(ExceptionInfo *info) {
     int c;
 
     // Unpack the arguments from the ExceptionInfo struct
-    char *fn = info->regs[1];
-    char **av = info->regs[2];
+    char *fn = (char *)info->regs[1];
+    char **av = (char **)info->regs[2];
+
+    // Copy them into the kernel, as paging may take them out of
+    // memory while LoadProgram blocks
+    if (fn == NULL || (fn = copy_user_string(fn)) == NULL) {
+        info->regs[0] = ERROR;
+        return;
+    }
 
-    if (fn == NULL) {
+    if ((av = copy_user_args(av)) == NULL) {
+        free(fn);
         info->regs[0] = ERROR;
         return;
     }
 
+    c = LoadProgram(fn, av, info);
+    free(fn);
+    free_args(av);
+
     // In case of error, either return or exit with ERROR status
-    switch (c = LoadProgram(fn, av, info)) {
+    switch (c) {
     case ERROR: // Continue running
         info->regs[0] = ERROR;
         return;
@@ -180,6 +232,195 @@ void KernelExec(ExceptionInfo *info) {
 
 }
 
+/*
+ * Builds a process with the given parent, whose region 0 is empty
+ * apart from a fresh kernel stack, and makes it runnable. The caller
+ * must then give it a copy of its own kernel stack with
+ * ContextSwitchForkHelper, before anything else can switch to it.
+ *
+ * Returns NULL if there is not enough memory for it.
+ */
+struct process_info *new_process(unsigned int parent) {
+    struct process_info *pcb;
+    int i;
+
+    if (KERNEL_STACK_PAGES + 1 > tot_pmem_pages - allocated_pages
+        || KERNEL_STACK_PAGES + 1 > available_pages()
+        || (pcb = (struct process_info *)
+            malloc(sizeof(struct process_info))) == NULL)
+        return NULL;
+
+    if (get_new_page_table(pcb) == ERROR) {
+        free(pcb);
+        return NULL;
+    }
+
+    memset(pcb->pt_vaddr, 0, PAGE_TABLE_SIZE);
+    for (i = PAGE_TABLE_LEN - KERNEL_STACK_PAGES; i < PAGE_TABLE_LEN; ++i) {
+        pcb->pt_vaddr[i] = (struct pte) {
+            .pfn = alloc_page(),
+            .uprot = PROT_NONE,
+            .kprot = PROT_READ | PROT_WRITE,
+            .valid = 1
+        };
+    }
+
+    *pcb = (struct process_info) {
+        .pid = next_pid++,
+        .page_table = pcb->page_table,
+        .pt_vaddr = pcb->pt_vaddr,
+        .program = active_process->program,
+        .parent = parent,
+        .active_children = 0,
+        .exited_children = 0
+    };
+
+    add_process(pcb);
+
+    return pcb;
+}
+
+/*
+ * Copies the user string s into the kernel heap. The string is
+ * walked again if paging in a later page of it paged out another.
+ *
+ * Returns NULL if s runs off the end of mapped user memory, or there
+ * is no memory for the copy.
+ */
+char *copy_user_string(char *s) {
+    char *copy;
+    unsigned int outs;
+    int len;
+
+    do {
+        outs = swap_outs;
+        len = 0;
+
+        do {
+            if ((len == 0 || ((long)(s + len) & PAGEOFFSET) == 0)
+                && fault_in_pages(s + len, 1, 0) == ERROR)
+                return NULL;
+        } while (s[len++] != '\0');
+    } while (swap_outs != outs);
+
+    if ((copy = malloc(len)) != NULL)
+        memcpy(copy, s, len);
+
+    return copy;
+}
+
+/*
+ * Frees an argument vector built by copy_user_args.
+ */
+void free_args(char **args) {
+    int i;
+
+    for (i = 0; args[i] != NULL; ++i)
+        free(args[i]);
+    free(args);
+}
+
+/*
+ * Copies the NULL terminated user argument vector argv, and the
+ * strings in it, into the kernel heap. A NULL argv gives an empty
+ * vector.
+ *
+ * Returns NULL if any of it is not in user memory, or there is no
+ * memory for the copy.
+ */
+char **copy_user_args(char **argv) {
+    char **args;
+    int i, n = 0;
+
+    if (argv != NULL) {
+        do {
+            if (fault_in_pages(argv + n, sizeof(char *), 0) == ERROR)
+                return NULL;
+        } while (argv[n++] != NULL);
+        --n;
+    }
+
+    if ((args = calloc(n + 1, sizeof(char *))) == NULL)
+        return NULL;
+
+    for (i = 0; i < n; ++i) {
+        // Copying the last string may have paged argv out
+        if (fault_in_pages(argv + i, sizeof(char *), 0) == ERROR
+            || (args[i] = copy_user_string(argv[i])) == NULL) {
+            free_args(args);
+            return NULL;
+        }
+    }
+
+    return args;
+}
+
+/*
+ * Implements the Spawn() kernel call.
+ *
+ * Creates a child process running the program name with arguments
+ * argv, as Fork followed by Exec in the child would, but without
+ * copying the caller's address space. The child starts with only a
+ * copy of the caller's kernel stack, and loads the program itself
+ * the first time it runs. The name and arguments are copied into the
+ * kernel first, so the caller is free to change them once Spawn
+ * returns.
+ *
+ * Returns the pid of the child, or ERROR if the arguments are not
+ * valid, the program cannot be opened, or there is not enough memory
+ * for the new process. If the program turns out not to be loadable,
+ * the child exits with status ERROR.
+ */
+int KernelSpawn(char *name, char **argv, ExceptionInfo *info) {
+    struct process_info *pcb;
+    char *file, **args;
+    int c, fd, pid = active_process->pid;
+
+    TracePrintf(0, "SPAWN: pid = %d\n", pid);
+
+    if (name == NULL || (file = copy_user_string(name)) == NULL)
+        return ERROR;
+
+    if ((args = copy_user_args(argv)) == NULL) {
+        free(file);
+        return ERROR;
+    }
+
+    // Fail in the caller rather than the child if there is no program
+    if ((fd = open(file, O_RDONLY)) >= 0)
+        close(fd);
+
+    // Page out to make room for the child's kernel stack if need be
+    if (fd < 0 || reserve_frames(KERNEL_STACK_PAGES + 1) == ERROR
+        || (pcb = new_process(pid)) == NULL) {
+        free(file);
+        free_args(args);
+        return ERROR;
+    }
+
+    ++(active_process->active_children);
+
+    // Copy the kernel stack into the child, which resumes below
+    ContextSwitch(ContextSwitchForkHelper, &(pcb->ctx), pcb, NULL);
+
+    if (active_process->pid == pid)
+        return pcb->pid;
+
+    TracePrintf(1, "SPAWN: pid = %d loading '%s'\n", active_process->pid,
+        file);
+
+    // The file and args still belong to the child; LoadProgram copies
+    // the args onto the new user stack
+    c = LoadProgram(file, args, info);
+    free(file);
+    free_args(args);
+
+    if (c != 0)
+        KernelExit(ERROR);
+
+    return 0;
+}
+
 /*
  * Implements the Exit() kernel call.
  *
@@ -197,6 +438,10 @@ void KernelExit(int status) {
 
     TracePrintf(0, "EXIT: pid = %d\n", active_process->pid);
 
+    // The kernel halts after the last process exits
+    if (live_processes == 1)
+        disk_sync();
+
     TracePrintf(1, "EXIT: Finding parent %d of process %d\n",
         active_process->parent, active_process->pid);
 
@@ -260,12 +505,25 @@ void KernelExit(int status) {
 
     TracePrintf(1, "EXIT: Freeing physical memory of process %d\n",
         active_process->pid);
-    // Free the physical memory used by the user
+    // Free the physical memory used by the user, detaching shared
+    // memory first
+    shm_release(active_process);
     for (i = 0; i < PAGE_TABLE_LEN - KERNEL_STACK_PAGES; ++i) {
-        if ((CURRENT_PAGE_TABLE + i)->valid)
-            free_page((CURRENT_PAGE_TABLE + i)->pfn);
+        if (USER_PAGE_MAPPED(CURRENT_PAGE_TABLE + i))
+            free_user_page(CURRENT_PAGE_TABLE + i);
     }
 
+    TracePrintf(1, "EXIT: Process %d took %d stack faults\n",
+        active_process->pid, active_process->stack_faults);
+
+    // Release any heap pages which were reserved but never touched
+    committed_pages -= active_process->heap_reserved;
+    active_process->heap_reserved = 0;
+
+    // Fail any IPC with this process which is still outstanding
+    ipc_exit(active_process);
+    remove_pid(active_process);
+
     // No active parent, process is an orphan
     if (parent != NULL) {
         TracePrintf(1, "EXIT: Found parent with pid = %d\n", active_process->parent);
@@ -294,16 +552,25 @@ void KernelExit(int status) {
 
         TracePrintf(1, "EXIT: Parent %d exited children = %d\n",
             parent->pid, parent->exited_children);
+
+        // Wake the parent if it is blocked in Wait
+        if (parent->waiting_child) {
+            parent->waiting_child = 0;
+            push_process(&process_queue, &pq_tail, parent);
+        }
     }
 
 
     // Get rid of the current process, and switch to a new one
+    --live_processes;
     struct process_info *next = pop_process(&process_queue, &pq_tail);
     if (next == NULL) {
 
-        // If all processes have exited, exit the kernel
-        if (process_queue == NULL && waiting_queue == NULL)
-            Halt();
+        // If all processes have exited, exit the kernel. Processes
+        // blocked in Wait, on a terminal, in IPC or on the disk are
+        // still live, though on no queue
+        if (live_processes == 0 && disk_active == NULL)
+            kernel_halt();
 
         next = idle;
     }
@@ -332,6 +599,9 @@ void KernelExit(int status) {
 int KernelWait(int *status_ptr) {
     TracePrintf(0, "WAIT: pid = %d\n", active_process->pid);
 
+    if (fault_in_pages(status_ptr, sizeof(int), 1) == ERROR)
+        return ERROR;
+
     if (active_process->active_children == 0
     && active_process->exited_children == 0) {
         TracePrintf(1, "WAIT: Error\n");
@@ -339,58 +609,45 @@ int KernelWait(int *status_ptr) {
     }
 
 
-    while (1) {
-        if (active_process->exited_children > 0) {
-            TracePrintf(1, "WAIT: Searching for exit status, ec = %x\n",
-                active_process->exited_children);
+    // Exit wakes us when a child exits
+    while (active_process->exited_children == 0) {
+        TracePrintf(1, "WAIT: No children exited, blocking\n");
+        active_process->waiting_child = 1;
+        RemoveSwitch();
+    }
 
-            // Find the first exit status struct for a child of this process
-            struct exit_status *es = exit_queue;
-            while (es != NULL) {
-                if (es->parent == active_process->pid)
-                    break;
-                es = es->next;
-            }
+    TracePrintf(1, "WAIT: Searching for exit status, ec = %x\n",
+        active_process->exited_children);
 
-            if (es != NULL) {
-
-                --(active_process->exited_children);
-
-                // Save the exit status
-                *status_ptr = es->status;
-
-                // Remove es from queue
-                if (es->prev != NULL)
-                    es->prev->next = es->next;
-                else
-                    exit_queue = es->next;
-
-                if (es->next != NULL)
-                    es->next->prev = es->prev;
-                else
-                    eq_tail = es->prev;
-
-                // Free the status struct and return the pid
-                int pid = es->pid;
-                free(es);
-                return pid;
-            } else {
-                es = exit_queue;
-                while (es != NULL) {
-                    TracePrintf(0, "WAIT: pid = %d, parent = %d, status = %d\n",
-                        es->pid, es->parent, es->status);
-                    es = es->next;
-                }
-                KernelDelay(1);
-            }
-        } else {    // If no children have exited, block
-            TracePrintf(1, "WAIT: No children exited, blocking\n");
+    // Find the first exit status struct for a child of this process
+    struct exit_status *es = exit_queue;
+    while (es->parent != active_process->pid)
+        es = es->next;
 
-            // Delay for 1 tick -> prevents starvation when two waiting calls
-            // repeatedly switch.
-            KernelDelay(1);
-        }
-    }
+    // status_ptr may have been paged out while we blocked
+    if (fault_in_pages(status_ptr, sizeof(int), 1) == ERROR)
+        return ERROR;
+
+    --(active_process->exited_children);
+
+    // Save the exit status
+    *status_ptr = es->status;
+
+    // Remove es from queue
+    if (es->prev != NULL)
+        es->prev->next = es->next;
+    else
+        exit_queue = es->next;
+
+    if (es->next != NULL)
+        es->next->prev = es->prev;
+    else
+        eq_tail = es->prev;
+
+    // Free the status struct and return the pid
+    int pid = es->pid;
+    free(es);
+    return pid;
 }
 
 /*
@@ -407,46 +664,44 @@ int KernelBrk(void *addr) {
 
     TracePrintf(0, "BRK: pid = %d\n", active_process->pid);
 
-    // Ensure requested address is valid
-    if (new_brk > VMEM_LIMIT - KERNEL_STACK_SIZE - PAGESIZE) {
+    // Ensure requested address is valid, leaving a page below the stack
+    // and any shared memory
+    if (new_brk > heap_ceiling(active_process) - PAGESIZE) {
         TracePrintf(1, "User heap attempting to grow into the User stack/redzone\n");
         return ERROR;
     }
 
     // Already allocated sufficient virtual memory
-    if (new_brk <= active_process->user_brk) {
+    if (new_brk <= (long)active_process->user_brk) {
         TracePrintf(1, "Sufficient memory already allocated\n");
         return 0;
     }
 
-    // Check if there is sufficient physical memory before allocating new pages
-    int num_new_pages = (new_brk - (long)active_process->user_brk) >> PAGESHIFT;
-    if (num_new_pages > tot_pmem_pages - allocated_pages) {
+    // Check if there is sufficient physical memory which has not already
+    // been promised to another reservation before reserving new pages
+    int num_new_pages = (new_brk - (long)UP_TO_PAGE(active_process->user_brk))
+        >> PAGESHIFT;
+    if (num_new_pages > available_pages()) {
         TracePrintf(1,
-            "Unable to expand user heap, insufficient physical memory\n");
+            "Unable to expand user heap, insufficient memory\n");
         return ERROR;
     }
 
-    // Expand user heap
-    int cur_page = (long)active_process->user_brk >> PAGESHIFT;
-    struct pte* page_table = (struct pte*)(VMEM_LIMIT - PAGESIZE);
+    // Reserve the new heap pages. They are left invalid, and are only
+    // backed by physical memory when first touched.
+    int cur_page = (long)UP_TO_PAGE(active_process->user_brk) >> PAGESHIFT;
+    struct pte* page_table = CURRENT_PAGE_TABLE;
     for (i = cur_page; i < cur_page + num_new_pages; ++i) {
         if (!page_table[i].valid) {
-            *(page_table + i) = (struct pte){
-                .valid = 1,
-                .kprot = PROT_READ | PROT_WRITE,
-                .uprot = PROT_READ | PROT_WRITE,
-                .pfn = alloc_page()
-            };
-
-            // Increment the number of pages assigned to the process
-            ++active_process->user_pages;
+            ++active_process->heap_reserved;
+            ++committed_pages;
         }
     }
 
     active_process->user_brk = (void *)new_brk;
 
-    TracePrintf(1, "BRK: Expanded user heap to %x\n", (unsigned int)addr);
+    TracePrintf(1, "BRK: Expanded user heap to %x, %d pages reserved\n",
+        (unsigned int)addr, active_process->heap_reserved);
 
     return 0;
 }
@@ -489,6 +744,37 @@ int KernelDelay(int clock_ticks) {
     return 0;
  }
 
+/*
+ * Implements the GetStats() kernel call.
+ *
+ * Fills in stats with the resource usage of process pid.
+ *
+ * Returns 0 on success, ERROR if there is no such process or stats
+ * is not a valid buffer.
+ */
+int KernelGetStats(int pid, struct procstats *stats) {
+    struct process_info *pcb = find_process(pid);
+
+    if (pcb == NULL
+        || fault_in_pages(stats, sizeof(struct procstats), 1) == ERROR)
+        return ERROR;
+
+    *stats = (struct procstats) {
+        .pid = pcb->pid,
+        .ticks_run = pcb->ticks_run,
+        .ticks_ready = pcb->ticks_ready,
+        .voluntary_switches = pcb->switches - pcb->preemptions,
+        .involuntary_switches = pcb->preemptions,
+        .page_faults = pcb->page_faults,
+        .frames = resident_pages(pcb) + KERNEL_STACK_PAGES,
+        .tty_in = pcb->tty_in,
+        .tty_out = pcb->tty_out,
+        .syscalls = pcb->syscalls
+    };
+
+    return 0;
+}
+
 /*
  * Implements the TtyRead() kernel call.
  */
@@ -497,6 +783,9 @@ int KernelTtyRead(int tty_id, void *buf, int len) {
         return 0;
     }
 
+    if (fault_in_pages(buf, len, 1) == ERROR)
+        return ERROR;
+
     //get the correct terminal info
     struct terminal_info *terminal = terminals[tty_id];
     struct available_line *line = (terminal->next_line);
@@ -531,6 +820,14 @@ int KernelTtyRead(int tty_id, void *buf, int len) {
 
         RemoveSwitch();
 
+        // buf may have been paged out while we were blocked
+        if (fault_in_pages(buf, active_process->line->len, 1) == ERROR) {
+            if (active_process->line->free)
+                free(active_process->line->orig_ptr);
+            free(active_process->line);
+            return ERROR;
+        }
+
         memcpy(buf, active_process->line->line, active_process->line->len);
         //free the line if it was the end
         if (active_process->line->free) {
@@ -546,11 +843,22 @@ int KernelTtyRead(int tty_id, void *buf, int len) {
  * Implements the TtyWrite() kernel call.
  */
 int KernelTtyWrite(int tty_id, void *buf, int len) {
+    char *copy;
+
     TracePrintf(0, "TtyWrite %d\n", active_process->pid);
 
     if (len > TERMINAL_MAX_LINE)
         return ERROR;
 
+    if (fault_in_pages(buf, len, 0) == ERROR)
+        return ERROR;
+
+    // buf may be paged out while we wait for the terminal, so
+    // transmit from a copy
+    if ((copy = malloc(len > 0 ? len : 1)) == NULL)
+        return ERROR;
+    memcpy(copy, buf, len);
+
     struct terminal_info *terminal = terminals[tty_id];
     
     TracePrintf(1, "TtyWrite: Process %d entering write queue on "
@@ -568,7 +876,8 @@ int KernelTtyWrite(int tty_id, void *buf, int len) {
     TracePrintf(1, "TtyWrite: Writing %d bytes to terminal %d from "
                    "virtual address %p\n", len, tty_id, (void*)buf);
 
-    TtyTransmit(tty_id, buf, len);
+    TtyTransmit(tty_id, copy, len);
+    free(copy);
 
     terminal->busy = 1;
     
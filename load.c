@@ -38,13 +38,15 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
     char *cp;
     char *cp2;
     char **cpp;
-    char *argbuf;
+    char *argbuf = NULL;
     unsigned long argcount;
     int size;
     int text_npg;
+    int data_npg;
     int data_bss_npg;
     int stack_npg;
     int i;
+    int program;
 
     TracePrintf(0, "LoadProgram '%s', args %p\n", name, args);
 
@@ -53,6 +55,9 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
 	    return (-1);
     }
 
+    // name may be in the address space about to be replaced
+    program = profile_program(name);
+
     status = LoadInfo(fd, &li);
     TracePrintf(0, "LoadProgram: LoadInfo status %d\n", status);
     switch (status) {
@@ -122,6 +127,7 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
     TracePrintf(2, "LoadProgram: Assigned pointers\n");
 
     text_npg = li.text_size >> PAGESHIFT;
+    data_npg = UP_TO_PAGE(li.data_size) >> PAGESHIFT;
     data_bss_npg = UP_TO_PAGE(li.data_size + li.bss_size) >> PAGESHIFT;
     stack_npg = (USER_STACK_LIMIT - DOWN_TO_PAGE(cpp)) >> PAGESHIFT;
 
@@ -141,14 +147,14 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
     }
 
     /*
-     *  And make sure there will be enough physical memory to
-     *  load the new program.
+     *  And make sure there will be enough memory to load the new
+     *  program.
      */
     int req_pages = text_npg + data_bss_npg + stack_npg
         - active_process->user_pages;
-    if (allocated_pages + req_pages > tot_pmem_pages) {
+    if (req_pages > available_pages() + (int)active_process->heap_reserved) {
         TracePrintf(0,
-            "LoadProgram: program '%s' size too large for physical memory\n",
+            "LoadProgram: program '%s' size too large for memory\n",
             name);
         free(argbuf);
         close(fd);
@@ -158,7 +164,7 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
     // Set stack pointer
     info->sp = (void *)cpp;
 
-    struct pte *page_table = (struct pte *)(VMEM_LIMIT - PAGESIZE);
+    struct pte *page_table = CURRENT_PAGE_TABLE;
     //struct pte *page_table = active_process->page_table;
     TracePrintf(0, "LoadProgram: %p\n", page_table);
     TracePrintf(1, "LoadProgram: erasing PT at %p\n", page_table);
@@ -166,16 +172,36 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
     /*
      *  Free all the old physical memory belonging to this process,
      *  but be sure to leave the kernel stack for this process (which
-     *  is also in Region 0) alone.
+     *  is also in Region 0) alone.  Shared memory segments are
+     *  detached first.
      */
+    shm_release(active_process);
     for (i = MEM_INVALID_PAGES; i < PAGE_TABLE_LEN - KERNEL_STACK_PAGES; ++i) {
-        if ((page_table + i)->valid == 1) {
-            free_page((page_table + i)->pfn);
+        if (USER_PAGE_MAPPED(page_table + i)) {
+            free_user_page(page_table + i);
             (page_table + i)->valid = 0;
         }
     }
     TracePrintf(2, "LoadProgram: freed stack from PT at %p\n", page_table);
 
+    /*
+     *  Also release the heap pages which were reserved by Brk but
+     *  never touched.
+     */
+    committed_pages -= active_process->heap_reserved;
+    active_process->heap_reserved = 0;
+
+    /*
+     *  Page out other processes to make room for the pages given
+     *  frames below.
+     */
+    if (reserve_frames(text_npg + data_npg + stack_npg) == ERROR) {
+        TracePrintf(0, "LoadProgram: no frames for '%s'\n", name);
+        free(argbuf);
+        close(fd);
+        return (-2);
+    }
+
     /*
      *  Fill in the page table with the right number of text,
      *  data+bss, and stack pages.  We set all the text pages
@@ -195,8 +221,8 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
         };
     }
 
-    /* Then the data and bss pages */
-    for (; i < MEM_INVALID_PAGES + text_npg + data_bss_npg; ++i) {
+    /* Then the data pages, including any bss sharing the last of them */
+    for (; i < MEM_INVALID_PAGES + text_npg + data_npg; ++i) {
         TracePrintf(2, "data/bss pages %p\n", page_table + i);
         *(page_table + i) = (struct pte){
             .valid = 1,
@@ -206,6 +232,15 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
         };
     }
 
+    /*
+     *  The rest of the bss starts out as the zero frame, and each page
+     *  is only given a frame of its own when it is first written.
+     */
+    for (; i < MEM_INVALID_PAGES + text_npg + data_bss_npg; ++i) {
+        TracePrintf(2, "bss pages %p\n", page_table + i);
+        map_zero_page(page_table + i);
+    }
+
 
     /* And finally the user stack pages */
     for (i = 1; i <= stack_npg; ++i) {
@@ -223,13 +258,17 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
     active_process->user_pages = data_bss_npg + text_npg + stack_npg;
     active_process->user_brk = (void *)(MEM_INVALID_SIZE +
         ((data_bss_npg + text_npg) << PAGESHIFT));
+    active_process->stack_base = (void *)(USER_STACK_LIMIT -
+        (stack_npg << PAGESHIFT));
+    active_process->stack_faults = 0;
+    active_process->program = program;
 
     /*
      *  All pages for the new address space are now in place.  Flush
      *  the TLB to get rid of all the old PTEs from this process, so
      *  we'll be able to do the read() into the new pages below.
      */
-    WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_0);
+    flush_tlb(TLB_FLUSH_0);
     TracePrintf(2, "flushed tlb\n");
 
     /*
@@ -253,13 +292,14 @@ LoadProgram(char *name, char **args, ExceptionInfo *info)
 
     TracePrintf(2,"text prots set\n");
 
-    WriteRegister(REG_TLB_FLUSH, TLB_FLUSH_0);
+    flush_tlb(TLB_FLUSH_0);
     TracePrintf(2,"flushed again\n");
     /*
-     *  Zero out the bss
+     *  Zero out the part of the bss in the last data page
      */
+    size = (data_npg << PAGESHIFT) - li.data_size;
     memset((void *)(MEM_INVALID_SIZE + li.text_size + li.data_size),
-        '\0', li.bss_size);
+        '\0', li.bss_size < size ? li.bss_size : size);
     TracePrintf(2,"zerod out bss\n");
     /*
      *  Set the entry point in the exception frame.
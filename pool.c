@@ -0,0 +1,198 @@
+#include <string.h>
+
+#include "kernel.h"
+
+/*
+ * Pools of pre-loaded processes for PoolSpawn.
+ *
+ * The first PoolSpawn of a program gives it a pool, and is served by
+ * Spawn. From then on, whenever the idle process would otherwise sit
+ * out a clock tick, it starts a process which loads the program with
+ * no arguments and then parks itself in the pool, off every queue,
+ * until there are POOL_SIZE of them. PoolSpawn hands out a parked
+ * process by making it runnable, and when it runs it only has to
+ * rebuild the argument area at the top of its stack before returning
+ * to the program's entry point.
+ *
+ * Parked processes keep their pids, and are in the list of all
+ * processes with no parent until they are handed out.
+ */
+
+/*
+ * Finds the pool for the program name, giving it a free slot if it
+ * has none.
+ *
+ * Returns NULL if every slot is taken by another program.
+ */
+static struct process_pool *find_pool(char *name) {
+    struct process_pool *free_slot = NULL;
+    int i;
+
+    for (i = 0; i < POOL_PROGRAMS; ++i) {
+        if (pools[i].name == NULL) {
+            if (free_slot == NULL)
+                free_slot = &pools[i];
+        } else if (strcmp(pools[i].name, name) == 0)
+            return &pools[i];
+    }
+
+    if (free_slot == NULL || (free_slot->name = malloc(strlen(name) + 1))
+        == NULL)
+        return NULL;
+
+    strcpy(free_slot->name, name);
+
+    return free_slot;
+}
+
+/*
+ * Replaces the argument area LoadProgram built at the top of the
+ * current process's stack with args, laid out the same way, and
+ * points the stack pointer in info at it.
+ *
+ * Returns ERROR if the stack cannot grow to hold the arguments.
+ */
+static int set_args(char **args, ExceptionInfo *info) {
+    char *cp, **cpp;
+    int i, argcount, size = 0;
+
+    for (argcount = 0; args[argcount] != NULL; ++argcount)
+        size += strlen(args[argcount]) + 1;
+
+    cp = ((char *)USER_STACK_LIMIT) - size;
+    cpp = (char **)((unsigned long)cp & (-1 << 4));
+    cpp = (char **)((unsigned long)cpp - ((argcount + 4) * sizeof(void *)));
+
+    if (fault_in_pages(cpp, USER_STACK_LIMIT - (long)cpp, 1) == ERROR)
+        return ERROR;
+
+    info->sp = (void *)cpp;
+
+    *cpp++ = (char *)(long)argcount;
+    for (i = 0; i < argcount; ++i) {
+        *cpp++ = cp;
+        strcpy(cp, args[i]);
+        cp += strlen(cp) + 1;
+    }
+    *cpp++ = NULL;
+    *cpp++ = NULL;
+    *cpp++ = 0;
+
+    return 0;
+}
+
+/*
+ * Halts the kernel if every process left is idle or parked in a pool,
+ * as no process remains to hand them out.
+ */
+static void halt_if_parked(void) {
+    if (live_processes == 0 && disk_active == NULL)
+        kernel_halt();
+}
+
+/*
+ * Called by the clock handler whenever the idle process is running.
+ * Starts a process to load a program for the first pool which is short
+ * of processes, if memory allows.
+ *
+ * The new process resumes here with a copy of idle's kernel stack, so
+ * it returns from the clock interrupt straight into its program once
+ * it has been handed out.
+ */
+void pool_refill(ExceptionInfo *info) {
+    struct process_pool *pool = NULL;
+    struct process_info *pcb;
+    char *args[2];
+    int i;
+
+    if (tot_pmem_pages - allocated_pages - committed_pages
+        < POOL_RESERVE_PAGES)
+        return;
+
+    for (i = 0; i < POOL_PROGRAMS && pool == NULL; ++i) {
+        if (pools[i].name != NULL && !pools[i].failed
+            && pools[i].count + pools[i].loading < POOL_SIZE)
+            pool = &pools[i];
+    }
+
+    if (pool == NULL || (pcb = new_process(NO_PARENT)) == NULL)
+        return;
+
+    pcb->pool = pool;
+    ++pool->loading;
+
+    ContextSwitch(ContextSwitchForkHelper, &(pcb->ctx), pcb, NULL);
+
+    // Idle carries on
+    if (active_process != pcb)
+        return;
+
+    TracePrintf(1, "POOL: pid = %d loading '%s'\n", pcb->pid, pool->name);
+
+    args[0] = pool->name;
+    args[1] = NULL;
+    --pool->loading;
+    if (LoadProgram(pool->name, args, info) != 0) {
+        pool->failed = 1;
+        KernelExit(ERROR);
+    }
+
+    // Park until PoolSpawn hands us out
+    push_process(&pool->parked, &pool->parked_tail, pcb);
+    ++pool->count;
+    --live_processes;
+    halt_if_parked();
+    RemoveSwitch();
+
+    TracePrintf(1, "POOL: pid = %d handed out\n", active_process->pid);
+
+    i = set_args(active_process->spawn_args, info);
+    free_args(active_process->spawn_args);
+    active_process->spawn_args = NULL;
+
+    if (i == ERROR)
+        KernelExit(ERROR);
+}
+
+/*
+ * Implements the PoolSpawn() kernel call.
+ *
+ * Starts the program name with arguments argv as a child of the
+ * caller, as Spawn does, but hands out a process from the program's
+ * pool which has already loaded it, if there is one. Otherwise the
+ * call falls back to Spawn, and the pool is filled in the background.
+ *
+ * Returns the pid of the child, or ERROR as Spawn does.
+ */
+int KernelPoolSpawn(char *name, char **argv, ExceptionInfo *info) {
+    struct process_pool *pool;
+    struct process_info *pcb;
+    char *file, **args;
+
+    TracePrintf(0, "POOL SPAWN: pid = %d\n", active_process->pid);
+
+    if (name == NULL || (file = copy_user_string(name)) == NULL)
+        return ERROR;
+
+    pool = find_pool(file);
+    free(file);
+
+    if (pool == NULL || pool->parked == NULL)
+        return KernelSpawn(name, argv, info);
+
+    if ((args = copy_user_args(argv)) == NULL)
+        return ERROR;
+
+    pcb = pop_process(&pool->parked, &pool->parked_tail);
+    --pool->count;
+
+    pcb->pool = NULL;
+    pcb->parent = active_process->pid;
+    pcb->spawn_args = args;
+    ++(active_process->active_children);
+
+    push_process(&process_queue, &pq_tail, pcb);
+    ++live_processes;
+
+    return pcb->pid;
+}
@@ -0,0 +1,119 @@
+#include <string.h>
+
+#include "kernel.h"
+
+/*
+ * Clock tick PC sampling profiler.
+ *
+ * While profiling is on, every clock tick records the pc it
+ * interrupted, the active pid, the program it was running and whether
+ * it was in kernel mode. Samples are kept in order until
+ * PROFILE_SAMPLES have been taken; later ones are only counted.
+ *
+ * Programs are recorded by index into a table of the names passed to
+ * LoadProgram, since a pid may run several programs and samples
+ * outlive their processes. Dumping writes the table and the samples
+ * to the TRACE file, where tools/profile_report symbolizes the pcs
+ * against the program binaries.
+ */
+
+/*
+ * Returns the index of the program called name in the program table,
+ * adding it if necessary. Index 0 stands for a program not in the
+ * table, for when it is full.
+ */
+int profile_program(char *name) {
+    int i;
+
+    for (i = 1; i < num_profile_programs; ++i) {
+        if (strcmp(profile_programs[i], name) == 0)
+            return i;
+    }
+
+    if (num_profile_programs == 0)
+        num_profile_programs = 1;
+
+    if (num_profile_programs == PROFILE_PROGRAMS
+        || (profile_programs[num_profile_programs] =
+            malloc(strlen(name) + 1)) == NULL)
+        return 0;
+
+    strcpy(profile_programs[num_profile_programs], name);
+
+    return num_profile_programs++;
+}
+
+/*
+ * Records a sample of the state the clock interrupted, if profiling.
+ */
+void profile_tick(ExceptionInfo *info) {
+    if (!profiling)
+        return;
+
+    if (profile_count == PROFILE_SAMPLES) {
+        ++profile_lost;
+        return;
+    }
+
+    profile_samples[profile_count++] = (struct profile_sample) {
+        .pc = (unsigned long)info->pc,
+        .pid = active_process->pid,
+        .program = active_process->program,
+        .kernel = (info->psr & PSR_MODE) != 0
+    };
+}
+
+/*
+ * Writes the program table and the samples taken so far to the TRACE
+ * file, as lines tools/profile_report can read back.
+ */
+void profile_dump(void) {
+    int i;
+
+    TracePrintf(0, "PROFILE: %d samples, %u lost\n", profile_count,
+        profile_lost);
+
+    for (i = 1; i < num_profile_programs; ++i)
+        TracePrintf(0, "PROFILE-PROGRAM: %d %s\n", i, profile_programs[i]);
+
+    for (i = 0; i < profile_count; ++i) {
+        TracePrintf(0, "PROFILE-SAMPLE: %lx %d %d %d\n",
+            profile_samples[i].pc, profile_samples[i].pid,
+            profile_samples[i].program, profile_samples[i].kernel);
+    }
+}
+
+/*
+ * Implements the Profile() kernel call.
+ *
+ * PROFILE_START discards any samples and starts sampling,
+ * PROFILE_STOP stops it, and PROFILE_DUMP writes the samples to the
+ * TRACE file.
+ *
+ * Returns the number of samples taken so far, or ERROR if op is not
+ * one of these.
+ */
+int KernelProfile(int op) {
+    TracePrintf(1, "PROFILE: pid = %d, op = %d\n", active_process->pid, op);
+
+    switch (op) {
+    case PROFILE_START:
+        profile_count = 0;
+        profile_lost = 0;
+        profiling = 1;
+        break;
+
+    case PROFILE_STOP:
+        profiling = 0;
+        break;
+
+    case PROFILE_DUMP:
+        profile_dump();
+        break;
+
+    default:
+        return ERROR;
+    }
+
+    return profile_count;
+}
@@ -0,0 +1,62 @@
+#include <comp421/hardware.h>
+#include <comp421/yalnix.h>
+
+/*
+ * Profiler demonstration.
+ *
+ * Profiles a loop which spends about three quarters of its time in
+ * heavy() and a quarter in light(), then dumps the samples. Running
+ * tools/profile_report over the TRACE file should show the two
+ * functions in about that ratio.
+ */
+
+#define RUN_TICKS   100
+
+static volatile int sink;
+
+void
+heavy(void)
+{
+    int i;
+
+    for (i = 0; i < 30000; ++i)
+        sink += i;
+}
+
+void
+light(void)
+{
+    int i;
+
+    for (i = 0; i < 10000; ++i)
+        sink += i;
+}
+
+int
+main()
+{
+    int start, samples, i;
+
+    Profile(PROFILE_START);
+
+    start = GetTicks();
+    while (GetTicks() - start < RUN_TICKS) {
+        for (i = 0; i < 16; ++i) {
+            heavy();
+            light();
+        }
+    }
+
+    Profile(PROFILE_STOP);
+    samples = Profile(PROFILE_DUMP);
+
+    TracePrintf(0, "profile_demo: %d samples in %d ticks\n", samples,
+        RUN_TICKS);
+
+    if (Profile(0) != ERROR) {
+        TracePrintf(0, "profile_demo: Profile accepted an invalid op\n");
+        Exit(ERROR);
+    }
+
+    Exit(0);
+}
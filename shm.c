@@ -0,0 +1,303 @@
+#include "kernel.h"
+
+/*
+ * Shared memory segments.
+ *
+ * ShmCreate allocates a segment of zero-filled frames, and ShmAttach
+ * maps all of them into region 0 of the caller, between the heap and
+ * the stack, with PTE_SHARED set on each pte. Every process attached
+ * to a segment maps the same frames, so what one writes the others
+ * see without any copying.
+ *
+ * The segment holds a ref on each of its frames and each pte mapping
+ * one holds another, so an attached frame is never freed, paged out
+ * or made copy-on-write. A segment is kept by the process which
+ * created it, until it exits or execs, and by every attachment, and
+ * is freed once neither keeps it. Fork gives the child the parent's
+ * attachments, and Exit and Exec detach them all.
+ *
+ * Attachments are placed as high as they fit, leaving SHM_STACK_GAP
+ * pages below the stack for it to grow into. The heap and the stack
+ * may then only grow to within a page of them.
+ */
+
+/*
+ * Returns the segment with the given id, or NULL if there is none.
+ */
+static struct shm_segment *find_segment(int id) {
+    int i;
+
+    for (i = 0; i < SHM_SEGMENTS; ++i) {
+        if (id != 0 && shm_segments[i].id == id)
+            return &shm_segments[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * Frees the segment and its frames if nothing keeps it any more.
+ */
+static void put_segment(struct shm_segment *seg) {
+    int i;
+
+    if (seg->creator != 0 || seg->attaches != 0)
+        return;
+
+    TracePrintf(1, "SHM: Freeing segment %d, %d pages\n", seg->id,
+        seg->npages);
+
+    for (i = 0; i < seg->npages; ++i)
+        free_page(seg->pfns[i]);
+    free(seg->pfns);
+
+    seg->id = 0;
+}
+
+/*
+ * Unmaps the attachment a from the region 0 of pcb and lets go of its
+ * segment. The caller frees a.
+ */
+static void unmap(struct process_info *pcb, struct shm_attachment *a) {
+    struct pte *pte = pcb->pt_vaddr + a->vpn;
+    int i;
+
+    for (i = 0; i < a->segment->npages; ++i) {
+        free_user_page(pte + i);
+        (pte + i)->valid = 0;
+    }
+
+    if (pcb == active_process)
+        flush_tlb(TLB_FLUSH_0);
+
+    --a->segment->attaches;
+    put_segment(a->segment);
+}
+
+/*
+ * Implements the ShmCreate() kernel call.
+ *
+ * Creates a segment of size bytes, rounded up to whole pages, all of
+ * them zero. The segment is not attached to the caller.
+ *
+ * Returns the id of the segment, or ERROR if size is not positive or
+ * larger than region 0, every segment is in use, or there is not
+ * enough memory.
+ */
+int KernelShmCreate(int size) {
+    struct shm_segment *seg = NULL;
+    unsigned int *pfns;
+    int i, npages;
+
+    TracePrintf(0, "SHM CREATE: pid = %d, size = %d\n", active_process->pid,
+        size);
+
+    if (size <= 0 || size > PAGE_TABLE_LEN << PAGESHIFT)
+        return ERROR;
+
+    npages = UP_TO_PAGE(size) >> PAGESHIFT;
+    if (npages > available_pages()
+        || (pfns = malloc(npages * sizeof(unsigned int))) == NULL)
+        return ERROR;
+
+    // Page out to make room if need be, which may block
+    if (reserve_frames(npages) == ERROR) {
+        free(pfns);
+        return ERROR;
+    }
+
+    for (i = 0; i < SHM_SEGMENTS && seg == NULL; ++i) {
+        if (shm_segments[i].id == 0)
+            seg = &shm_segments[i];
+    }
+
+    if (seg == NULL) {
+        free(pfns);
+        return ERROR;
+    }
+
+    for (i = 0; i < npages; ++i)
+        pfns[i] = alloc_zeroed_page();
+
+    *seg = (struct shm_segment) {
+        .id = ++shm_next_id,
+        .creator = active_process->pid,
+        .npages = npages,
+        .pfns = pfns,
+        .attaches = 0
+    };
+
+    return seg->id;
+}
+
+/*
+ * Implements the ShmAttach() kernel call.
+ *
+ * Maps the segment id, readable and writable, at the highest free
+ * range of region 0 which leaves a page above the heap and
+ * SHM_STACK_GAP pages below the stack.
+ *
+ * Returns the address the segment is mapped at, or ERROR if there is
+ * no such segment or no room for it.
+ */
+int KernelShmAttach(int id) {
+    struct shm_segment *seg = find_segment(id);
+    struct shm_attachment *a;
+    long vpn, bottom, top;
+    int i, n = 0;
+
+    TracePrintf(0, "SHM ATTACH: pid = %d, id = %d\n", active_process->pid, id);
+
+    if (seg == NULL
+        || (a = malloc(sizeof(struct shm_attachment))) == NULL)
+        return ERROR;
+
+    bottom = ((long)UP_TO_PAGE(active_process->user_brk) >> PAGESHIFT) + 1;
+    top = ((long)active_process->stack_base >> PAGESHIFT) - SHM_STACK_GAP;
+
+    // Find the highest run of npages unmapped pages
+    for (vpn = top - 1; vpn >= bottom && n < seg->npages; --vpn)
+        n = USER_PAGE_MAPPED(CURRENT_PAGE_TABLE + vpn) ? 0 : n + 1;
+
+    if (n < seg->npages) {
+        free(a);
+        return ERROR;
+    }
+    ++vpn;
+
+    for (i = 0; i < seg->npages; ++i) {
+        *(CURRENT_PAGE_TABLE + vpn + i) = (struct pte) {
+            .pfn = seg->pfns[i],
+            .unused = PTE_SHARED,
+            .uprot = PROT_READ | PROT_WRITE,
+            .kprot = PROT_READ | PROT_WRITE,
+            .valid = 1
+        };
+        ++(free_pages + seg->pfns[i])->refs;
+    }
+    flush_tlb(TLB_FLUSH_0);
+
+    *a = (struct shm_attachment) {
+        .segment = seg,
+        .vpn = vpn,
+        .next = active_process->shm
+    };
+    active_process->shm = a;
+    ++seg->attaches;
+
+    TracePrintf(1, "SHM: Attached segment %d to process %d at %p\n", id,
+        active_process->pid, (void *)(vpn << PAGESHIFT));
+
+    return vpn << PAGESHIFT;
+}
+
+/*
+ * Implements the ShmDetach() kernel call.
+ *
+ * Unmaps the segment attached at addr.
+ *
+ * Returns ERROR if no segment is attached at addr, 0 otherwise.
+ */
+int KernelShmDetach(void *addr) {
+    struct shm_attachment **ap, *a;
+
+    TracePrintf(0, "SHM DETACH: pid = %d, addr = %p\n", active_process->pid,
+        addr);
+
+    for (ap = &active_process->shm; (a = *ap) != NULL; ap = &a->next) {
+        if ((long)addr == (long)a->vpn << PAGESHIFT)
+            break;
+    }
+
+    if (a == NULL)
+        return ERROR;
+
+    *ap = a->next;
+    unmap(active_process, a);
+    free(a);
+
+    return 0;
+}
+
+/*
+ * Gives child, whose page table is a copy of parent's with a ref
+ * taken on every shared frame, the attachments of parent. An
+ * attachment there is no memory to record is unmapped from the child
+ * instead.
+ */
+void shm_fork(struct process_info *parent, struct process_info *child) {
+    struct shm_attachment *a, *copy;
+    int i;
+
+    for (a = parent->shm; a != NULL; a = a->next) {
+        if ((copy = malloc(sizeof(struct shm_attachment))) == NULL) {
+            for (i = 0; i < a->segment->npages; ++i) {
+                free_user_page(child->pt_vaddr + a->vpn + i);
+                (child->pt_vaddr + a->vpn + i)->valid = 0;
+            }
+            continue;
+        }
+
+        *copy = (struct shm_attachment) {
+            .segment = a->segment,
+            .vpn = a->vpn,
+            .next = child->shm
+        };
+        child->shm = copy;
+        ++a->segment->attaches;
+    }
+}
+
+/*
+ * Detaches every segment pcb has attached, and lets go of the
+ * segments it created, as it exits or execs.
+ */
+void shm_release(struct process_info *pcb) {
+    struct shm_attachment *a;
+    int i;
+
+    while ((a = pcb->shm) != NULL) {
+        pcb->shm = a->next;
+        unmap(pcb, a);
+        free(a);
+    }
+
+    for (i = 0; i < SHM_SEGMENTS; ++i) {
+        if (shm_segments[i].id != 0 && shm_segments[i].creator == pcb->pid) {
+            shm_segments[i].creator = 0;
+            put_segment(&shm_segments[i]);
+        }
+    }
+}
+
+/*
+ * Returns the address the heap of pcb may not grow past: the lowest
+ * segment it has attached, or its stack.
+ */
+long heap_ceiling(struct process_info *pcb) {
+    struct shm_attachment *a;
+    long ceiling = (long)pcb->stack_base;
+
+    for (a = pcb->shm; a != NULL; a = a->next) {
+        if ((long)a->vpn << PAGESHIFT < ceiling)
+            ceiling = (long)a->vpn << PAGESHIFT;
+    }
+
+    return ceiling;
+}
+
+/*
+ * Returns the address the stack of pcb may not grow below: the end of
+ * the highest segment it has attached, or of its heap.
+ */
+long stack_floor(struct process_info *pcb) {
+    struct shm_attachment *a;
+    long floor = (long)UP_TO_PAGE(pcb->user_brk);
+
+    for (a = pcb->shm; a != NULL; a = a->next) {
+        if ((long)(a->vpn + a->segment->npages) << PAGESHIFT > floor)
+            floor = (long)(a->vpn + a->segment->npages) << PAGESHIFT;
+    }
+
+    return floor;
+}
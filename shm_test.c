@@ -0,0 +1,104 @@
+#include <comp421/hardware.h>
+#include <comp421/yalnix.h>
+
+/*
+ * Shared memory test.
+ *
+ * Creates a segment and attaches it, then forks NUM_WORKERS children
+ * which each fill their own stripe of it, half through the attachment
+ * they inherited and half through one of their own, and checks the
+ * parent sees every write. Then detaches and attaches the segment
+ * again to check it kept its contents, and that the calls turn down
+ * bad arguments.
+ */
+
+#define NUM_WORKERS     4
+#define STRIPE          (2 * PAGESIZE)
+
+static int
+worker(int id, char *shm, int n)
+{
+    char *own;
+    int i;
+
+    if ((own = ShmAttach(id)) == NULL || own == shm)
+        return 1;
+
+    for (i = 0; i < STRIPE / 2; ++i)
+        shm[n * STRIPE + i] = (char)(n + i);
+    for (i = STRIPE / 2; i < STRIPE; ++i)
+        own[n * STRIPE + i] = (char)(n + i);
+
+    return ShmDetach(own) == ERROR;
+}
+
+static int
+check(char *shm)
+{
+    int n, i;
+
+    for (n = 0; n < NUM_WORKERS; ++n) {
+        for (i = 0; i < STRIPE; ++i) {
+            if (shm[n * STRIPE + i] != (char)(n + i)) {
+                TracePrintf(0, "shm_test: stripe %d byte %d is wrong\n", n, i);
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+int
+main()
+{
+    char *shm;
+    int id, n, status, errors = 0;
+
+    if (ShmCreate(0) != ERROR || ShmAttach(-1) != NULL
+        || ShmDetach((void *)PAGESIZE) != ERROR) {
+        TracePrintf(0, "shm_test: accepted a bad argument\n");
+        ++errors;
+    }
+
+    if ((id = ShmCreate(NUM_WORKERS * STRIPE)) == ERROR
+        || (shm = ShmAttach(id)) == NULL) {
+        TracePrintf(0, "shm_test: could not create a segment\n");
+        Exit(ERROR);
+    }
+
+    for (n = 0; n < NUM_WORKERS * STRIPE; ++n) {
+        if (shm[n] != 0) {
+            TracePrintf(0, "shm_test: new segment is not zero\n");
+            ++errors;
+            break;
+        }
+    }
+
+    for (n = 0; n < NUM_WORKERS; ++n) {
+        if (Fork() == 0)
+            Exit(worker(id, shm, n));
+    }
+
+    for (n = 0; n < NUM_WORKERS; ++n) {
+        Wait(&status);
+        errors += status;
+    }
+
+    errors += check(shm);
+
+    if (ShmDetach(shm) == ERROR || ShmDetach(shm) != ERROR) {
+        TracePrintf(0, "shm_test: detach failed\n");
+        ++errors;
+    }
+
+    if ((shm = ShmAttach(id)) == NULL) {
+        TracePrintf(0, "shm_test: could not attach again\n");
+        ++errors;
+    } else
+        errors += check(shm);
+
+    TracePrintf(0, "shm_test: %d workers, %d errors\n", NUM_WORKERS, errors);
+
+    Exit(errors ? ERROR : 0);
+}
@@ -0,0 +1,290 @@
+#include "kernel.h"
+
+/*
+ * Paging user memory out to the swap area at the end of the disk.
+ *
+ * When frames run short, pages of user memory are written to swap
+ * slots of SECTORS_PER_PAGE sectors and their frames freed. The pte of
+ * a page in swap is left invalid with PTE_SWAPPED set and the slot in
+ * its pfn, and the next fault on it reads it back into a new frame.
+ *
+ * Victims are chosen by a clock which sweeps the user pages of every
+ * process in turn. The hardware keeps no referenced bits, so the clock
+ * takes user access away from each page it passes and marks it
+ * PTE_UNREFERENCED. A page used again faults, which gives the access
+ * back, and a page the hand finds still unreferenced on its next lap
+ * is paged out. The zero frame and frames shared by several ptes are
+ * never paged out.
+ *
+ * Swap slots shared by a forked child are counted in swap_refs, and
+ * each pte after the first commits a page, as it takes a frame of its
+ * own when read back. Paging blocks on the disk, so the kernel must
+ * check user memory again after any call which may page before
+ * touching it; swap_outs counts the pages written out so far for this.
+ *
+ * Only one process pages at a time, as all paging goes through
+ * swap_blocks.
+ */
+
+/*
+ * Blocks the active process until no other process is paging.
+ */
+static void lock_swap(void) {
+    while (swap_busy) {
+        push_process(&swap_waiters, &swap_waiters_tail, active_process);
+        RemoveSwitch();
+    }
+
+    swap_busy = 1;
+}
+
+/*
+ * Lets the processes waiting to page run again.
+ */
+static void unlock_swap(void) {
+    struct process_info *pcb;
+
+    swap_busy = 0;
+
+    while ((pcb = pop_process(&swap_waiters, &swap_waiters_tail)) != NULL)
+        push_process(&process_queue, &pq_tail, pcb);
+}
+
+/*
+ * Advances the clock hand to the next page to page out, taking user
+ * access away from the pages it passes on the way. Gives up after
+ * three laps of every user page, which leaves time for the pages of
+ * the active process to be marked and then found again.
+ *
+ * Returns the pte of the victim and sets owner and vpn to where it is
+ * mapped, or returns NULL if no page can be paged out.
+ */
+static struct pte *clock_victim(struct process_info **owner,
+    unsigned int *vpn) {
+    struct active_process *p;
+    struct pte *pte;
+    unsigned int steps, limit = 0;
+    unsigned int user_pages = PAGE_TABLE_LEN - KERNEL_STACK_PAGES;
+
+    for (p = all_processes; p != NULL; p = p->next)
+        limit += 3 * (user_pages - MEM_INVALID_PAGES);
+
+    // The process the hand was at may have exited
+    for (p = all_processes; p != NULL && p->pid != clock_pid; p = p->next)
+        ;
+    if (p == NULL) {
+        p = all_processes;
+        clock_vpn = MEM_INVALID_PAGES;
+    }
+
+    for (steps = 0; steps < limit; ++steps) {
+        if (clock_vpn >= user_pages) {
+            clock_vpn = MEM_INVALID_PAGES;
+            p = p->next == NULL ? all_processes : p->next;
+        }
+
+        pte = p->pcb->pt_vaddr + clock_vpn++;
+
+        if (p->pcb == idle || !pte->valid || pte->pfn == zero_pfn
+            || (free_pages + pte->pfn)->refs > 1)
+            continue;
+
+        if (pte->unused & PTE_UNREFERENCED) {
+            clock_pid = p->pid;
+            *owner = p->pcb;
+            *vpn = clock_vpn - 1;
+            return pte;
+        }
+
+        pte->unused |= PTE_UNREFERENCED;
+        pte->uprot = PROT_NONE;
+
+        if (p->pcb == active_process)
+            flush_tlb((RCS421RegVal)((clock_vpn - 1) << PAGESHIFT));
+    }
+
+    clock_pid = p->pid;
+
+    return NULL;
+}
+
+/*
+ * Pages out the page the clock picks into a free swap slot. The swap
+ * lock must be held.
+ *
+ * Returns ERROR if there is no free slot or no page to page out,
+ * 0 otherwise.
+ */
+static int evict(void) {
+    struct process_info *owner;
+    struct pte *pte;
+    unsigned int slot, pfn, vpn;
+
+    for (slot = 0; slot < SWAP_PAGES && swap_refs[slot] != 0; ++slot)
+        ;
+
+    if (slot == SWAP_PAGES || (pte = clock_victim(&owner, &vpn)) == NULL)
+        return ERROR;
+
+    swap_refs[slot] = 1;
+    ++swapped_pages;
+
+    pfn = pte->pfn;
+    pte->valid = 0;
+    pte->pfn = slot;
+    pte->uprot = pte->kprot;
+    pte->unused = (pte->unused & PTE_COPY_ON_WRITE) | PTE_SWAPPED;
+
+    if (owner == active_process)
+        flush_tlb((RCS421RegVal)(vpn << PAGESHIFT));
+
+    ++swap_outs;
+    TRACE_EVENT(TRACE_SWAP_OUT, vpn, slot);
+    TracePrintf(2, "SWAP: Paging out page %u of process %d to slot %u\n",
+        vpn, owner->pid, slot);
+
+    // The frame is copied out before swap_io blocks, but is only freed
+    // once the write is done
+    swap_io(DISK_WRITE, slot, pfn);
+    free_page(pfn);
+
+    return 0;
+}
+
+/*
+ * Pages out until n frames, and PAGEOUT_FREE_FRAMES more, are free,
+ * or nothing more can be paged out. The swap lock must be held.
+ *
+ * Returns ERROR if fewer than n frames are free, 0 otherwise.
+ */
+static int make_room(int n) {
+    while (tot_pmem_pages - allocated_pages < n + PAGEOUT_FREE_FRAMES
+        && evict() == 0)
+        ;
+
+    if (tot_pmem_pages - allocated_pages < n)
+        return ERROR;
+
+    return 0;
+}
+
+/*
+ * Ensures that n frames are free for the active process to allocate,
+ * paging out if necessary.
+ *
+ * Returns ERROR if not enough frames can be freed, 1 if the process
+ * blocked, in which case any of its pages may have been paged out,
+ * and 0 if the frames were free already.
+ */
+int reserve_frames(int n) {
+    int r;
+
+    if (tot_pmem_pages - allocated_pages >= n + PAGEOUT_FREE_FRAMES
+        && !swap_busy)
+        return 0;
+
+    lock_swap();
+    r = make_room(n);
+    unlock_swap();
+
+    return r == ERROR ? ERROR : 1;
+}
+
+/*
+ * Pages out one page, for callers which count the frames they need
+ * themselves.
+ *
+ * Returns ERROR if no page can be paged out, 0 otherwise.
+ */
+int page_out(void) {
+    int r;
+
+    lock_swap();
+    r = evict();
+    unlock_swap();
+
+    return r;
+}
+
+/*
+ * Reads page vpn of pcb back from swap into a new frame.
+ *
+ * Returns ERROR if no frame can be freed for it, 0 otherwise, or if
+ * another process read it back first.
+ */
+int swap_in(struct process_info *pcb, unsigned int vpn) {
+    struct pte *pte = pcb->pt_vaddr + vpn;
+    unsigned int pfn, slot;
+
+    lock_swap();
+
+    if (!(pte->unused & PTE_SWAPPED)) {
+        unlock_swap();
+        return 0;
+    }
+
+    if (make_room(1) == ERROR || (pfn = alloc_page()) == ERROR) {
+        unlock_swap();
+        return ERROR;
+    }
+
+    slot = pte->pfn;
+    swap_io(DISK_READ, slot, pfn);
+    free_swap_slot(slot);
+
+    pte->pfn = pfn;
+    pte->valid = 1;
+    pte->unused &= ~PTE_SWAPPED;
+
+    if (pcb == active_process)
+        flush_tlb((RCS421RegVal)(vpn << PAGESHIFT));
+
+    ++swap_ins;
+    TRACE_EVENT(TRACE_SWAP_IN, vpn, pfn);
+    TracePrintf(2, "SWAP: Read page %u of process %d back from slot %u\n",
+        vpn, pcb->pid, slot);
+
+    unlock_swap();
+
+    return 0;
+}
+
+/*
+ * Lets go of one pte's hold on a swap slot. The slot is freed with
+ * the last of them, and any other gives back the page it committed.
+ */
+void free_swap_slot(unsigned int slot) {
+    if (swap_refs[slot] > 1) {
+        --swap_refs[slot];
+        --committed_pages;
+        return;
+    }
+
+    swap_refs[slot] = 0;
+    --swapped_pages;
+}
+
+/*
+ * Returns the number of pages of memory, in frames or in swap, which
+ * are neither in use nor committed.
+ */
+int available_pages(void) {
+    return tot_pmem_pages + SWAP_PAGES - allocated_pages - swapped_pages
+        - committed_pages;
+}
+
+/*
+ * Returns the number of user pages of pcb which hold a frame of their
+ * own, not counting the zero frame or shared memory.
+ */
+int resident_pages(struct process_info *pcb) {
+    int i, n = 0;
+
+    for (i = 0; i < PAGE_TABLE_LEN - KERNEL_STACK_PAGES; ++i) {
+        if (pcb->pt_vaddr[i].valid && pcb->pt_vaddr[i].pfn != zero_pfn
+            && !(pcb->pt_vaddr[i].unused & PTE_SHARED))
+            ++n;
+    }
+
+    return n;
+}
@@ -0,0 +1,216 @@
+/*
+ * Host-side report for the kernel's clock tick profiler.
+ *
+ * Profile(PROFILE_DUMP), or a halt while profiling, writes the program
+ * table and the samples into the TRACE file. This reads them back,
+ * symbolizes each pc against the binary it was sampled in using nm,
+ * and prints the functions which took the most samples.
+ *
+ * Usage: profile_report [-d dir] [-k kernel] [-n count] [TRACE]
+ *
+ * Program names are looked up as given to Exec, relative to dir
+ * (default "."). Kernel mode samples are symbolized against the kernel
+ * binary (default "yalnix").
+ *
+ * Build with: make profile_report
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_PROGRAMS    128     // Programs, plus one slot for the kernel
+#define KERNEL          0       // Binary index of the kernel
+
+struct symbol {
+    unsigned long addr;
+    char *name;
+};
+
+struct binary {
+    char *path;
+    int loaded;
+    struct symbol *symbols;     // Text symbols sorted by address
+    int num_symbols;
+};
+
+struct entry {
+    int binary;
+    const char *function;
+    int samples;
+};
+
+static struct binary binaries[MAX_PROGRAMS + 1];
+static struct entry *entries;
+static int num_entries;
+
+static char *
+join(const char *dir, const char *name)
+{
+    char *path = malloc(strlen(dir) + strlen(name) + 2);
+
+    if (name[0] == '/')
+        strcpy(path, name);
+    else
+        sprintf(path, "%s/%s", dir, name);
+
+    return path;
+}
+
+static void
+load_symbols(struct binary *b)
+{
+    char cmd[1024], line[512], type, name[400];
+    unsigned long addr;
+    FILE *nm;
+    int size = 0;
+
+    b->loaded = 1;
+    snprintf(cmd, sizeof(cmd), "nm -n --defined-only '%s' 2>/dev/null",
+        b->path);
+    if ((nm = popen(cmd, "r")) == NULL)
+        return;
+
+    while (fgets(line, sizeof(line), nm) != NULL) {
+        if (sscanf(line, "%lx %c %399s", &addr, &type, name) != 3
+            || (type != 'T' && type != 't' && type != 'W' && type != 'w'))
+            continue;
+
+        if (b->num_symbols == size) {
+            size = size ? 2 * size : 256;
+            b->symbols = realloc(b->symbols, size * sizeof(struct symbol));
+        }
+        b->symbols[b->num_symbols].addr = addr;
+        b->symbols[b->num_symbols++].name = strdup(name);
+    }
+
+    pclose(nm);
+}
+
+static const char *
+symbolize(struct binary *b, unsigned long pc)
+{
+    int lo = 0, hi, mid;
+
+    if (!b->loaded)
+        load_symbols(b);
+
+    // Find the last symbol at or below pc
+    hi = b->num_symbols - 1;
+    if (hi < 0 || pc < b->symbols[0].addr)
+        return "??";
+
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (b->symbols[mid].addr <= pc)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return b->symbols[lo].name;
+}
+
+static void
+count(int binary, const char *function)
+{
+    int i;
+
+    for (i = 0; i < num_entries; ++i) {
+        if (entries[i].binary == binary && entries[i].function == function) {
+            ++entries[i].samples;
+            return;
+        }
+    }
+
+    entries = realloc(entries, (num_entries + 1) * sizeof(struct entry));
+    entries[num_entries++] = (struct entry) { binary, function, 1 };
+}
+
+static int
+by_samples(const void *a, const void *b)
+{
+    return ((const struct entry *)b)->samples
+        - ((const struct entry *)a)->samples;
+}
+
+int
+main(int argc, char **argv)
+{
+    char line[512], name[400], *p;
+    const char *dir = ".", *kernel = "yalnix";
+    unsigned long pc;
+    int opt, index, pid, program, mode, binary, i;
+    int top = 20, total = 0, kernel_samples = 0;
+    FILE *in;
+
+    while ((opt = getopt(argc, argv, "d:k:n:")) != -1) {
+        if (opt == 'd')
+            dir = optarg;
+        else if (opt == 'k')
+            kernel = optarg;
+        else if (opt == 'n')
+            top = atoi(optarg);
+        else {
+            fprintf(stderr, "usage: %s [-d dir] [-k kernel] [-n count] "
+                "[TRACE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    in = optind < argc ? fopen(argv[optind], "r") : fopen("TRACE", "r");
+    if (in == NULL) {
+        perror(optind < argc ? argv[optind] : "TRACE");
+        return 1;
+    }
+
+    binaries[KERNEL].path = join(dir, kernel);
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if ((p = strstr(line, "PROFILE-PROGRAM:")) != NULL) {
+            if (sscanf(p, "PROFILE-PROGRAM: %d %399s", &index, name) == 2
+                && index > 0 && index < MAX_PROGRAMS) {
+                free(binaries[index].path);
+                binaries[index] = (struct binary) { .path = join(dir, name) };
+            }
+            continue;
+        }
+
+        if ((p = strstr(line, "PROFILE-SAMPLE:")) == NULL
+            || sscanf(p, "PROFILE-SAMPLE: %lx %d %d %d", &pc, &pid, &program,
+                &mode) != 4)
+            continue;
+
+        ++total;
+        if (mode) {
+            ++kernel_samples;
+            binary = KERNEL;
+        } else
+            binary = program > 0 && program < MAX_PROGRAMS
+                && binaries[program].path != NULL ? program : -1;
+
+        count(binary, binary < 0 ? "??" : symbolize(&binaries[binary], pc));
+    }
+
+    fclose(in);
+
+    if (total == 0) {
+        fprintf(stderr, "no PROFILE-SAMPLE records found\n");
+        return 1;
+    }
+
+    qsort(entries, num_entries, sizeof(struct entry), by_samples);
+
+    printf("%d samples, %d in kernel mode\n\n", total, kernel_samples);
+    printf("%8s %6s  %-20s %s\n", "SAMPLES", "%", "PROGRAM", "FUNCTION");
+    for (i = 0; i < num_entries && i < top; ++i) {
+        printf("%8d %5.1f%%  %-20s %s\n", entries[i].samples,
+            100.0 * entries[i].samples / total,
+            entries[i].binary < 0 ? "??" :
+            strrchr(binaries[entries[i].binary].path, '/') + 1,
+            entries[i].function);
+    }
+
+    return 0;
+}
@@ -0,0 +1,237 @@
+/*
+ * Host-side decoder for the kernel trace ring.
+ *
+ * kernel_halt dumps the trace ring into the TRACE file as TRACE-EVENT
+ * lines. This reads them back and prints each record as text, or with
+ * -j as Chrome trace JSON (load it at chrome://tracing or in Perfetto).
+ *
+ * Usage: trace_decode [-j] [-t tick_us] [TRACE]
+ *
+ * Records only carry clock_count, so in JSON each tick is taken to be
+ * tick_us microseconds long (default 10000) and the records logged
+ * during a tick are spread a microsecond apart. In the JSON, each
+ * process gets a "run" track built from the context switches and a
+ * "kernel calls" track; everything else is an instant event.
+ *
+ * Build with: make trace_decode
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "comp421/yalnix.h"
+
+#define MAX_PIDS    1024
+
+static const char *event_names[TRACE_NUM_EVENTS] = {
+    [TRACE_CLOCK]       = "clock",
+    [TRACE_SWITCH]      = "switch",
+    [TRACE_ENQUEUE]     = "enqueue",
+    [TRACE_SYSCALL]     = "syscall",
+    [TRACE_SYSRET]      = "sysret",
+    [TRACE_FAULT]       = "fault",
+    [TRACE_COW]         = "cow",
+    [TRACE_HEAP_PAGE]   = "heap_page",
+    [TRACE_FORK_PAGE]   = "fork_page",
+    [TRACE_DISK_START]  = "disk_start",
+    [TRACE_DISK_DONE]   = "disk_done",
+    [TRACE_SWAP_OUT]    = "swap_out",
+    [TRACE_SWAP_IN]     = "swap_in",
+};
+
+static const char *syscall_names[64] = {
+    [YALNIX_FORK] = "Fork", [YALNIX_EXEC] = "Exec", [YALNIX_EXIT] = "Exit",
+    [YALNIX_WAIT] = "Wait", [YALNIX_GETPID] = "GetPid", [YALNIX_BRK] = "Brk",
+    [YALNIX_DELAY] = "Delay", [YALNIX_TTY_READ] = "TtyRead",
+    [YALNIX_TTY_WRITE] = "TtyWrite", [YALNIX_REGISTER] = "Register",
+    [YALNIX_SEND] = "Send", [YALNIX_RECEIVE] = "Receive",
+    [YALNIX_RECEIVESPECIFIC] = "ReceiveSpecific", [YALNIX_REPLY] = "Reply",
+    [YALNIX_FORWARD] = "Forward", [YALNIX_COPY_FROM] = "CopyFrom",
+    [YALNIX_COPY_TO] = "CopyTo", [YALNIX_READ_SECTOR] = "ReadSector",
+    [YALNIX_WRITE_SECTOR] = "WriteSector", [YALNIX_DISK_STATS] = "DiskStats",
+    [YALNIX_DISK_SYNC] = "DiskSync", [YALNIX_READ_SECTORS] = "ReadSectors",
+    [YALNIX_WRITE_SECTORS] = "WriteSectors", [YALNIX_GET_TICKS] = "GetTicks",
+    [YALNIX_GET_STATS] = "GetStats", [YALNIX_PROFILE] = "Profile",
+    [YALNIX_SPAWN] = "Spawn", [YALNIX_POOL_SPAWN] = "PoolSpawn",
+    [YALNIX_SHM_CREATE] = "ShmCreate", [YALNIX_SHM_ATTACH] = "ShmAttach",
+    [YALNIX_SHM_DETACH] = "ShmDetach",
+};
+
+// Start of the open "run" and "kernel calls" spans of each pid, or -1
+static double run_start[MAX_PIDS];
+static double call_start[MAX_PIDS];
+static unsigned int call_number[MAX_PIDS];
+
+static int json_events;
+
+static const char *
+event_name(unsigned int event)
+{
+    if (event < TRACE_NUM_EVENTS && event_names[event] != NULL)
+        return event_names[event];
+    return "unknown";
+}
+
+static const char *
+syscall_name(unsigned int code)
+{
+    if (code < 64 && syscall_names[code] != NULL)
+        return syscall_names[code];
+    return "unknown";
+}
+
+static void
+print_text(struct trace_event *e)
+{
+    printf("%8u  pid %3d  %-10s  ", e->time, e->pid, event_name(e->event));
+
+    switch (e->event) {
+    case TRACE_CLOCK:
+        printf("pc 0x%x", e->arg0);
+        break;
+    case TRACE_SWITCH:
+        printf("%u -> %u", e->arg0, e->arg1);
+        break;
+    case TRACE_ENQUEUE:
+        printf("pid %u", e->arg0);
+        break;
+    case TRACE_SYSCALL:
+        printf("%s", syscall_name(e->arg0));
+        break;
+    case TRACE_SYSRET:
+        printf("%s = %d", syscall_name(e->arg0), (int)e->arg1);
+        break;
+    case TRACE_FAULT:
+        printf("addr 0x%x", e->arg0);
+        break;
+    case TRACE_COW:
+    case TRACE_HEAP_PAGE:
+    case TRACE_FORK_PAGE:
+    case TRACE_SWAP_IN:
+        printf("vpn %u pfn %u", e->arg0, e->arg1);
+        break;
+    case TRACE_SWAP_OUT:
+        printf("vpn %u slot %u", e->arg0, e->arg1);
+        break;
+    case TRACE_DISK_START:
+    case TRACE_DISK_DONE:
+        printf("%s sector %u", e->arg1 == 0 ? "read" : "write", e->arg0);
+        break;
+    default:
+        printf("0x%x 0x%x", e->arg0, e->arg1);
+    }
+
+    printf("\n");
+}
+
+static void
+json_event(const char *name, const char *phase, double ts, double dur,
+    int pid, int tid, struct trace_event *e)
+{
+    printf("%s\n  {\"name\": \"%s\", \"ph\": \"%s\", \"ts\": %.0f, ",
+        json_events++ ? "," : "", name, phase, ts);
+    if (dur >= 0)
+        printf("\"dur\": %.0f, ", dur);
+    if (phase[0] == 'i')
+        printf("\"s\": \"t\", ");
+    printf("\"pid\": %d, \"tid\": %d", pid, tid);
+    if (e != NULL)
+        printf(", \"args\": {\"arg0\": %u, \"arg1\": %u}", e->arg0, e->arg1);
+    printf("}");
+}
+
+static void
+print_json(struct trace_event *e, double ts)
+{
+    int pid = e->pid < 0 || e->pid >= MAX_PIDS ? 0 : e->pid;
+
+    switch (e->event) {
+    case TRACE_SWITCH:
+        if (e->arg0 < MAX_PIDS && run_start[e->arg0] >= 0) {
+            json_event("run", "X", run_start[e->arg0],
+                ts - run_start[e->arg0], e->arg0, 0, NULL);
+            run_start[e->arg0] = -1;
+        }
+        if (e->arg1 < MAX_PIDS)
+            run_start[e->arg1] = ts;
+        break;
+    case TRACE_SYSCALL:
+        call_start[pid] = ts;
+        call_number[pid] = e->arg0;
+        break;
+    case TRACE_SYSRET:
+        // The process may have exited, or been forked, inside the call
+        if (call_start[pid] >= 0 && call_number[pid] == e->arg0)
+            json_event(syscall_name(e->arg0), "X", call_start[pid],
+                ts - call_start[pid], pid, 1, e);
+        call_start[pid] = -1;
+        break;
+    default:
+        json_event(event_name(e->event), "i", ts, -1, pid, 0, e);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    struct trace_event e;
+    char line[256], *p;
+    unsigned int last_time = 0, in_tick = 0;
+    double tick_us = 10000;
+    int json = 0, opt, pid, count = 0;
+    FILE *in;
+
+    while ((opt = getopt(argc, argv, "jt:")) != -1) {
+        if (opt == 'j')
+            json = 1;
+        else if (opt == 't')
+            tick_us = atof(optarg);
+        else {
+            fprintf(stderr, "usage: %s [-j] [-t tick_us] [TRACE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    in = optind < argc ? fopen(argv[optind], "r") : fopen("TRACE", "r");
+    if (in == NULL) {
+        perror(optind < argc ? argv[optind] : "TRACE");
+        return 1;
+    }
+
+    for (pid = 0; pid < MAX_PIDS; ++pid)
+        run_start[pid] = call_start[pid] = -1;
+
+    if (json)
+        printf("{\"traceEvents\": [");
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+        if ((p = strstr(line, "TRACE-EVENT:")) == NULL)
+            continue;
+
+        if (sscanf(p, "TRACE-EVENT: %x %hx %hd %x %x", &e.time, &e.event,
+            &e.pid, &e.arg0, &e.arg1) != 5)
+            continue;
+
+        ++count;
+        if (!json) {
+            print_text(&e);
+            continue;
+        }
+
+        in_tick = count == 1 || e.time != last_time ? 0 : in_tick + 1;
+        last_time = e.time;
+        print_json(&e, e.time * tick_us + in_tick);
+    }
+
+    if (json)
+        printf("\n]}\n");
+    else if (count == 0)
+        fprintf(stderr, "no TRACE-EVENT records found\n");
+
+    fclose(in);
+
+    return 0;
+}
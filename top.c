@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <string.h>
+#include <comp421/hardware.h>
+#include <comp421/yalnix.h>
+
+/*
+ * Per-process accounting test, in the style of top.
+ *
+ * Starts one worker of each kind below, then polls GetStats for each
+ * of them every POLL_TICKS ticks and prints a table until they have
+ * all exited. Each worker should stand out in its own column: the
+ * spinner in run time and preemptions, the writer in TTY bytes, the
+ * toucher in page faults and frames, and the sleeper in voluntary
+ * switches.
+ */
+
+#define POLL_TICKS      3
+// Ticks the spinner and writer keep going for
+#define BUSY_TICKS      12
+#define TOUCH_PAGES     64
+
+static void
+spinner(void)
+{
+    int start = GetTicks();
+    volatile int i;
+
+    while (GetTicks() - start < BUSY_TICKS)
+        for (i = 0; i < 10000; ++i)
+            ;
+}
+
+static void
+writer(void)
+{
+    char *line = "top: writer line\n";
+    int start = GetTicks();
+
+    while (GetTicks() - start < BUSY_TICKS)
+        TtyWrite(1, line, strlen(line));
+}
+
+static void
+toucher(void)
+{
+    char *p = malloc(TOUCH_PAGES * PAGESIZE);
+    int i;
+
+    if (p == NULL)
+        return;
+
+    for (i = 0; i < TOUCH_PAGES; ++i) {
+        p[i * PAGESIZE] = 1;
+        if (i % 8 == 7)
+            Delay(1);
+    }
+}
+
+static void
+sleeper(void)
+{
+    int i;
+
+    for (i = 0; i < 20; ++i)
+        Delay(1);
+}
+
+static void (*workers[])(void) = { spinner, writer, toucher, sleeper };
+static char *names[] = { "spinner", "writer", "toucher", "sleeper" };
+
+#define NUM_WORKERS (int)(sizeof(workers) / sizeof(workers[0]))
+
+int
+main()
+{
+    struct procstats stats;
+    int pids[NUM_WORKERS];
+    int i, status, alive = NUM_WORKERS;
+
+    for (i = 0; i < NUM_WORKERS; ++i) {
+        if ((pids[i] = Fork()) == 0) {
+            workers[i]();
+            Exit(0);
+        }
+    }
+
+    while (alive > 0) {
+        Delay(POLL_TICKS);
+
+        TracePrintf(0, "top: tick %d\n", GetTicks());
+        TracePrintf(0, "top: %5s %-8s %5s %5s %5s %5s %6s %6s %6s %6s %6s\n",
+            "PID", "NAME", "RUN", "READY", "VOL", "INVOL", "FAULTS",
+            "FRAMES", "TTYIN", "TTYOUT", "CALLS");
+
+        alive = 0;
+        for (i = 0; i <= NUM_WORKERS; ++i) {
+            if (GetStats(i < NUM_WORKERS ? pids[i] : GetPid(), &stats)
+                == ERROR)
+                continue;
+            if (i < NUM_WORKERS)
+                ++alive;
+
+            TracePrintf(0, "top: %5d %-8s %5d %5d %5d %5d %6d %6d %6d %6d %6d\n",
+                stats.pid, i < NUM_WORKERS ? names[i] : "top",
+                stats.ticks_run, stats.ticks_ready, stats.voluntary_switches,
+                stats.involuntary_switches, stats.page_faults, stats.frames,
+                stats.tty_in, stats.tty_out, stats.syscalls);
+        }
+    }
+
+    for (i = 0; i < NUM_WORKERS; ++i)
+        Wait(&status);
+
+    if (GetStats(-1, &stats) != ERROR) {
+        TracePrintf(0, "top: GetStats accepted an invalid pid\n");
+        Exit(ERROR);
+    }
+
+    Exit(0);
+}
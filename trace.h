@@ -0,0 +1,40 @@
+#ifndef _trace_h
+#define _trace_h
+
+/*
+ * Kernel trace records.
+ *
+ * Hot paths in the kernel log fixed-size binary records into a ring
+ * buffer with TRACE_EVENT, rather than formatting text with
+ * TracePrintf. kernel_halt dumps the ring to the TRACE file, and
+ * tools/trace_decode turns the dump back into readable text or Chrome
+ * trace JSON. This header is shared by both, so it must not depend on
+ * the rest of the kernel.
+ */
+
+// Event ids, and what arg0 and arg1 hold for each
+#define TRACE_CLOCK         1   // Clock tick: pc interrupted
+#define TRACE_SWITCH        2   // Context switch: from pid, to pid
+#define TRACE_ENQUEUE       3   // Process pushed onto a queue: its pid
+#define TRACE_SYSCALL       4   // Kernel call entered: call number
+#define TRACE_SYSRET        5   // Kernel call returning: call number, result
+#define TRACE_FAULT         6   // TRAP_MEMORY: faulting address
+#define TRACE_COW           7   // Copy-on-write page copied: vpn, new pfn
+#define TRACE_HEAP_PAGE     8   // Lazy heap page backed: vpn, pfn
+#define TRACE_FORK_PAGE     9   // Fork gave the child a page: vpn, pfn
+#define TRACE_DISK_START    10  // Disk transfer started: sector, op
+#define TRACE_DISK_DONE     11  // Disk transfer finished: sector, op
+#define TRACE_SWAP_OUT      12  // Page written to swap: vpn, slot
+#define TRACE_SWAP_IN       13  // Page read back from swap: vpn, pfn
+
+#define TRACE_NUM_EVENTS    14
+
+struct trace_event {
+    unsigned int time;          // clock_count when logged
+    unsigned short event;       // TRACE_* id
+    short pid;                  // Active process, or -1 during boot
+    unsigned int arg0;
+    unsigned int arg1;
+};
+
+#endif
@@ -1,63 +1,115 @@
+#include <string.h>
 
 #include "kernel.h"
 
 
 
-struct available_page_table {
-    void *page_table;
-    struct available_page_table *next;
-};
+/*
+ * Returns whether any page table in page k of the page table window
+ * is in use.
+ */
+static int window_page_used(int k) {
+    int t;
 
-struct available_page_table *page_tables = NULL;
+    for (t = k * TABLES_PER_PAGE; t < (k + 1) * TABLES_PER_PAGE; ++t) {
+        if (pt_window_used[t])
+            return 1;
+    }
 
+    return 0;
+}
 
 /*
- * Gets a pointer to a new page table.
+ * Finds a free page table in the page table window for a new region 0
+ * page table, where it stays mapped until the page table is freed.
+ * The kernel can then read and write any page table without remapping
+ * it. Page tables share pages, and a page of physical memory is only
+ * allocated for the first table in each page of the window.
+ *
+ * Sets page_table (physical address) and pt_vaddr of the given pcb.
  *
- * If there is an existing region of physical memory
- * allocated but not in use, that is returned. Otherwise
- * a new page is allocated, half is saved for a later
- * call and the other half is returned.
+ * Returns ERROR if there is no free physical page or page table in
+ * the window, 0 otherwise.
  */
-struct pte *get_new_page_table() {
-    void *page_table;
+int get_new_page_table(struct process_info *pcb) {
+    int t, k;
+    unsigned int pfn;
+
+    // Find a free table in the window
+    for (t = 0; t < pt_window_pages * TABLES_PER_PAGE; ++t) {
+        if (!pt_window_used[t])
+            break;
+    }
 
-    // Check if there is an available allocated page table
-    if (page_tables != NULL) {
-        struct available_page_table *pt = page_tables;
-        page_tables = page_tables->next;
+    if (t == pt_window_pages * TABLES_PER_PAGE)
+        return ERROR;
 
-        page_table = pt->page_table;
-        free(pt);
+    k = t / TABLES_PER_PAGE;
+    if (window_page_used(k))
+        pfn = kernel_page_table[PT_WINDOW_INDEX(k)].pfn;
+    else {
+        if ((pfn = alloc_page()) == ERROR)
+            return ERROR;
+
+        kernel_page_table[PT_WINDOW_INDEX(k)] = (struct pte) {
+            .pfn = pfn,
+            .uprot = PROT_NONE,
+            .kprot = PROT_READ | PROT_WRITE,
+            .valid = 1
+        };
+
+        // The page may still be cached from a previous page table
+        flush_tlb((RCS421RegVal)PT_WINDOW_SLOT(k));
+    }
 
-    } else {
-        // Allocate a new page
-        unsigned int pfn = alloc_page();
+    pt_window_used[t] = 1;
+    pcb->page_table = (void *)((pfn << PAGESHIFT)
+        + (t % TABLES_PER_PAGE) * PAGE_TABLE_SIZE);
+    pcb->pt_vaddr = PT_WINDOW_TABLE(t);
 
-        page_table = (void *)(pfn << PAGESHIFT);
-    }
+    return 0;
+}
+
+/*
+ * Releases the page table of the given pcb in the window, and frees
+ * the physical page holding it once no other table uses it.
+ */
+void free_page_table(struct process_info *pcb) {
+    int k = (VMEM_1_LIMIT - DOWN_TO_PAGE(pcb->pt_vaddr)) / PAGESIZE - 1;
+
+    pt_window_used[k * TABLES_PER_PAGE
+        + ((long)pcb->pt_vaddr & PAGEOFFSET) / PAGE_TABLE_SIZE] = 0;
 
-    return (struct pte *)page_table;
+    if (!window_page_used(k))
+        free_page((long)pcb->page_table >> PAGESHIFT);
 }
 
 /*
- * Frees the physical memory used to store a page table.
+ * Allocates the first page of zeroed_list, which must not be empty.
  *
- * If the other half of the physical page containing the
- * given page table is still in use, the memory is saved
- * to be reused by later calls. If the other half is also
- * free, then the physical page is freed.
+ * Returns its pfn.
  */
-void free_page_table(struct pte *pt) {
-    unsigned int pfn = ((unsigned int)pt) >> PAGESHIFT;
-    free_page(pfn);
+static unsigned int take_zeroed_page(void) {
+    struct free_page *page = zeroed_list;
+
+    zeroed_list = page->next_zeroed;
+    --zeroed_pages;
+
+    *page = (struct free_page) {
+        .in_use = 1,
+        .refs = 1
+    };
+    ++allocated_pages;
+
+    return page - free_pages;
 }
 
 /*
  * Allocates a page of physical memory.
  *
  * If there is an available page of physical memory, returns
- * the pfn of a newly allocated page.
+ * the pfn of a newly allocated page. Pages the idle process has
+ * cleared are only used once no other page is free.
  *
  * Returns ERROR if there are no free pages.
  */
@@ -70,20 +122,91 @@ unsigned int alloc_page(void) {
 
     // Find next available page
     for (i = 0; i < tot_pmem_pages; ++i) {
-        if ((free_pages + i)->in_use == 0) {
+        if ((free_pages + i)->in_use == 0 && !(free_pages + i)->zeroed) {
             (free_pages + i)->in_use = 1;
+            (free_pages + i)->refs = 1;
             ++allocated_pages;
             return i;
         }
     }
 
+    if (zeroed_list != NULL)
+        return take_zeroed_page();
+
     return ERROR;
 }
 
+/*
+ * Allocates a page of physical memory filled with zeros, preferring
+ * one the idle process has already cleared. Otherwise the page is
+ * cleared here, through copy slot 0.
+ *
+ * Returns ERROR if there are no free pages.
+ */
+unsigned int alloc_zeroed_page(void) {
+    unsigned int pfn;
+
+    if (zeroed_list != NULL) {
+        ++zeroed_hits;
+        return take_zeroed_page();
+    }
+
+    if ((pfn = alloc_page()) == ERROR)
+        return ERROR;
+
+    ++zeroed_misses;
+    map_copy_slot(0, pfn);
+    flush_tlb((RCS421RegVal)COPY_SLOT(0));
+    memset(COPY_SLOT(0), 0, PAGESIZE);
+
+    return pfn;
+}
+
+/*
+ * Called by the clock handler whenever the idle process is running.
+ * Clears up to NUM_COPY_SLOTS free pages through the copy slots and
+ * adds them to zeroed_list, until ZEROED_PAGES are ready, so that
+ * alloc_zeroed_page does not have to clear them when they are needed.
+ */
+void zero_free_pages(void) {
+    unsigned int batch[NUM_COPY_SLOTS];
+    unsigned int i, pfn;
+    int k, n = 0;
+
+    for (i = 0; i < tot_pmem_pages && n < NUM_COPY_SLOTS
+        && zeroed_pages + n < ZEROED_PAGES; ++i) {
+        pfn = zero_scan++ % tot_pmem_pages;
+        if ((free_pages + pfn)->in_use == 0 && !(free_pages + pfn)->zeroed)
+            batch[n++] = pfn;
+    }
+
+    if (n == 0)
+        return;
+
+    // Flush only the slots used, keeping the rest of region 1 in the TLB
+    for (k = 0; k < n; ++k) {
+        map_copy_slot(k, batch[k]);
+        flush_tlb((RCS421RegVal)COPY_SLOT(k));
+    }
+
+    for (k = 0; k < n; ++k) {
+        memset(COPY_SLOT(k), 0, PAGESIZE);
+
+        (free_pages + batch[k])->zeroed = 1;
+        (free_pages + batch[k])->next_zeroed = zeroed_list;
+        zeroed_list = free_pages + batch[k];
+    }
+    zeroed_pages += n;
+
+    TracePrintf(2, "ZERO: Cleared %d pages, %u ready\n", n, zeroed_pages);
+}
+
 /*
  * Marks the provided page frame as free.
  *
  * pfn should be a number corresponding to a page of physical memory.
+ * A frame shared by several ptes is only freed once the last of them
+ * lets go of it.
  *
  * Returns ERROR if the provided pfn is invalid, 0 otherwise.
  */
@@ -94,12 +217,442 @@ int free_page(int pfn) {
 
     // Check page was actually marked used
     if ((free_pages + pfn)->in_use) {
+        // Frame is still mapped elsewhere
+        if ((free_pages + pfn)->refs > 1) {
+            --(free_pages + pfn)->refs;
+            return 0;
+        }
+
         (free_pages + pfn)->in_use = 0;
+        (free_pages + pfn)->refs = 0;
         --allocated_pages;
     }
     return 0;
 }
 
+/*
+ * Frees the frame, or the swap slot, held by a mapped user pte. A
+ * copy-on-write pte also gives back the page committed to its first
+ * write.
+ */
+void free_user_page(struct pte *pte) {
+    if (pte->unused & PTE_COPY_ON_WRITE)
+        --committed_pages;
+
+    if (pte->unused & PTE_SWAPPED)
+        free_swap_slot(pte->pfn);
+    else
+        free_page(pte->pfn);
+    pte->unused = 0;
+}
+
+/*
+ * Backs a reserved heap page of the given process with a
+ * zero-filled page of physical memory.
+ *
+ * vpn is the region 0 page number of the heap page. The page
+ * must lie below the process break and not yet be valid. Since
+ * Brk already reserved the memory, the allocation cannot fail.
+ *
+ * If write is not set, the page is only about to be read, so it is
+ * mapped to the zero frame instead, and the reservation pays for the
+ * copy made on its first write.
+ *
+ * Returns ERROR if the page is not a reserved heap page, 0 otherwise.
+ */
+int alloc_heap_page(struct process_info *pcb, unsigned int vpn, int write) {
+    struct pte *pte = pcb->pt_vaddr + vpn;
+
+    if (vpn < MEM_INVALID_PAGES
+        || vpn >= (long)UP_TO_PAGE(pcb->user_brk) >> PAGESHIFT
+        || pte->valid || pcb->heap_reserved == 0)
+        return ERROR;
+
+    if (!write) {
+        map_zero_page(pte);
+        --pcb->heap_reserved;
+        --committed_pages;
+        ++pcb->user_pages;
+
+        if (pcb == active_process)
+            flush_tlb((RCS421RegVal)(vpn << PAGESHIFT));
+
+        return 0;
+    }
+
+    *pte = (struct pte) {
+        .valid = 1,
+        .kprot = PROT_READ | PROT_WRITE,
+        .uprot = PROT_READ | PROT_WRITE,
+        .pfn = alloc_zeroed_page()
+    };
+
+    // Convert the reservation into an allocated page
+    --pcb->heap_reserved;
+    --committed_pages;
+    ++pcb->user_pages;
+
+    if (pcb == active_process)
+        flush_tlb((RCS421RegVal)(vpn << PAGESHIFT));
+
+    TRACE_EVENT(TRACE_HEAP_PAGE, vpn, pte->pfn);
+
+    return 0;
+}
+
+/*
+ * Maps the zero frame read-only at the given user pte, as a
+ * copy-on-write page, and commits a page for its first write.
+ */
+void map_zero_page(struct pte *pte) {
+    *pte = (struct pte) {
+        .pfn = zero_pfn,
+        .unused = PTE_COPY_ON_WRITE,
+        .uprot = PROT_READ,
+        .kprot = PROT_READ,
+        .valid = 1
+    };
+    ++(free_pages + zero_pfn)->refs;
+    ++committed_pages;
+}
+
+/*
+ * Gives the given process a private, writable copy of the
+ * copy-on-write page vpn. The frame is only copied if another pte
+ * still shares it, which the zero frame always is. The page committed
+ * when the pte was shared pays for the copy, so the allocation cannot
+ * fail.
+ *
+ * Returns ERROR if the page is not copy-on-write, 0 otherwise.
+ */
+int copy_on_write(struct process_info *pcb, unsigned int vpn) {
+    struct pte *pte = pcb->pt_vaddr + vpn;
+    unsigned int pfn;
+
+    if (!pte->valid || !(pte->unused & PTE_COPY_ON_WRITE))
+        return ERROR;
+
+    if ((free_pages + pte->pfn)->refs > 1) {
+        // A copy of the zero frame only needs to be clear
+        if (pte->pfn == zero_pfn)
+            pfn = alloc_zeroed_page();
+        else {
+            pfn = alloc_page();
+
+            map_copy_slot(0, pte->pfn);
+            map_copy_slot(1, pfn);
+            flush_tlb((RCS421RegVal)COPY_SLOT(0));
+            flush_tlb((RCS421RegVal)COPY_SLOT(1));
+            memcpy(COPY_SLOT(1), COPY_SLOT(0), PAGESIZE);
+        }
+
+        free_page(pte->pfn);
+        pte->pfn = pfn;
+    }
+
+    pte->unused = 0;
+    pte->uprot = PROT_READ | PROT_WRITE;
+    pte->kprot = PROT_READ | PROT_WRITE;
+    --committed_pages;
+
+    if (pcb == active_process)
+        flush_tlb((RCS421RegVal)(vpn << PAGESHIFT));
+
+    TRACE_EVENT(TRACE_COW, vpn, pte->pfn);
+
+    return 0;
+}
+
+/*
+ * Grows the user stack of the active process so that addr is mapped.
+ *
+ * To reduce the number of faults taken by deep recursion, the stack
+ * grows STACK_GROW_PAGES pages at a time, but never closer than one
+ * page to the heap. If memory is short, the stack only grows down to
+ * the page containing addr.
+ *
+ * Returns ERROR if the stack would run into the heap or there is not
+ * enough memory, 0 otherwise. Other pages of the process may have
+ * been paged out to make room.
+ */
+int grow_user_stack(void *addr) {
+    long i;
+    long stack_base = (long)active_process->stack_base;
+    long heap_limit = stack_floor(active_process) + PAGESIZE;
+    long new_base = DOWN_TO_PAGE(addr) - (STACK_GROW_PAGES - 1) * PAGESIZE;
+    int available = available_pages();
+
+    if ((long)addr >= stack_base)
+        return 0;
+
+    // Check if expanding stack pushes into the heap.
+    if (DOWN_TO_PAGE(addr) < heap_limit)
+        return ERROR;
+
+    if (new_base < heap_limit)
+        new_base = heap_limit;
+    if ((stack_base - new_base) >> PAGESHIFT > available)
+        new_base = DOWN_TO_PAGE(addr);
+    if ((stack_base - new_base) >> PAGESHIFT > available)
+        return ERROR;
+
+    // Page out to make room for the new pages if need be
+    if (reserve_frames((stack_base - new_base) >> PAGESHIFT) == ERROR) {
+        new_base = DOWN_TO_PAGE(addr);
+        if (reserve_frames((stack_base - new_base) >> PAGESHIFT) == ERROR)
+            return ERROR;
+    }
+
+    for (i = new_base >> PAGESHIFT; i < stack_base >> PAGESHIFT; ++i) {
+        *(CURRENT_PAGE_TABLE + i) = (struct pte) {
+            .pfn = alloc_page(),
+            .uprot = PROT_READ | PROT_WRITE,
+            .kprot = PROT_READ | PROT_WRITE,
+            .valid = 1
+        };
+        ++active_process->user_pages;
+    }
+
+    active_process->stack_base = (void *)new_base;
+    ++active_process->stack_faults;
+
+    TracePrintf(1, "STACK: Grew stack of process %d to %p, %d stack faults\n",
+        active_process->pid, (void *)new_base, active_process->stack_faults);
+
+    return 0;
+}
+
+/*
+ * Ensures every page of the user buffer [addr, addr + len) is
+ * backed by physical memory, so that the kernel may access it.
+ * Reserved heap pages which have not yet been touched are
+ * allocated here, or only mapped to the zero frame if write is
+ * not set, and the stack is grown to cover the buffer.
+ * If write is set, shared copy-on-write pages are also made
+ * private, as the kernel is about to write to the buffer.
+ * Pages in swap are read back.
+ *
+ * Paging may block, and another process may page out part of the
+ * buffer meanwhile, so the buffer is walked again until a walk pages
+ * nothing out. The buffer is then resident until the caller next
+ * blocks.
+ *
+ * Returns ERROR if any page of the buffer is not mapped and is
+ * neither a reserved heap page nor stack, or memory runs out,
+ * 0 otherwise.
+ */
+int fault_in_pages(void *addr, int len, int write) {
+    struct pte *pte;
+    unsigned int outs;
+    long vpn;
+
+    if (len <= 0)
+        return 0;
+
+    do {
+        outs = swap_outs;
+
+        for (vpn = (long)addr >> PAGESHIFT;
+            vpn <= ((long)addr + len - 1) >> PAGESHIFT; ++vpn) {
+            if (vpn < 0 || vpn >= PAGE_TABLE_LEN - KERNEL_STACK_PAGES)
+                return ERROR;
+
+            pte = CURRENT_PAGE_TABLE + vpn;
+
+            if ((pte->unused & PTE_SWAPPED)
+                && swap_in(active_process, vpn) == ERROR)
+                return ERROR;
+
+            if (pte->valid) {
+                if (write && (pte->unused & PTE_COPY_ON_WRITE)) {
+                    if (reserve_frames(1) == ERROR)
+                        return ERROR;
+                    copy_on_write(active_process, vpn);
+                }
+                continue;
+            }
+
+            if (vpn < (long)UP_TO_PAGE(active_process->user_brk) >> PAGESHIFT) {
+                if (write && reserve_frames(1) == ERROR)
+                    return ERROR;
+                if (alloc_heap_page(active_process, vpn, write) == ERROR)
+                    return ERROR;
+            } else if (grow_user_stack((void *)(vpn << PAGESHIFT)) == ERROR)
+                return ERROR;
+        }
+    } while (swap_outs != outs);
+
+    return 0;
+}
+
+/*
+ * Copies the valid pages [first, last) of the current region 0 into
+ * the physical pages assigned to them in dst_table. Pages which
+ * dst_table maps to the zero frame are left alone.
+ *
+ * The destination pages are mapped into the region 1 copy slots
+ * NUM_COPY_SLOTS at a time, and only those slots are flushed, so that
+ * the kernel's other region 1 mappings stay in the TLB.
+ */
+void copy_pages(struct pte *dst_table, int first, int last) {
+    int i, k;
+    int n = 0;
+    int batch[NUM_COPY_SLOTS];
+
+    for (i = first; i <= last; ++i) {
+        if (i < last && (dst_table + i)->valid
+            && (dst_table + i)->pfn != zero_pfn)
+            batch[n++] = i;
+
+        if (n < NUM_COPY_SLOTS && (i < last || n == 0))
+            continue;
+
+        // Point the copy slots at the destination pages
+        for (k = 0; k < n; ++k) {
+            map_copy_slot(k, (dst_table + batch[k])->pfn);
+            flush_tlb((RCS421RegVal)COPY_SLOT(k));
+        }
+
+        TracePrintf(1, "COPY: Copying %d pages starting at page %d\n",
+            n, batch[0]);
+        for (k = 0; k < n; ++k)
+            memcpy(COPY_SLOT(k),
+                (const void *)(VMEM_0_BASE + batch[k] * PAGESIZE), PAGESIZE);
+
+        n = 0;
+    }
+}
+
+/*
+ * Maps the given frame at copy slot k. The caller must flush the
+ * slot from the TLB before using it.
+ */
+void map_copy_slot(int k, unsigned int pfn) {
+    kernel_page_table[COPY_SLOT_INDEX(k)] = (struct pte) {
+        .pfn = pfn,
+        .uprot = PROT_NONE,
+        .kprot = PROT_READ | PROT_WRITE,
+        .valid = 1
+    };
+}
+
+/*
+ * Flushes the given page, or region, from the TLB and counts
+ * the flush.
+ */
+void flush_tlb(RCS421RegVal addr) {
+    ++tlb_flushes;
+    WriteRegister(REG_TLB_FLUSH, addr);
+}
+
+/*
+ * Writes the trace ring to the TRACE file, oldest record first, as
+ * lines tools/trace_decode can read back.
+ */
+void trace_dump(void) {
+#if TRACE_EVENTS > 0
+    unsigned int i = trace_next > TRACE_EVENTS ? trace_next - TRACE_EVENTS : 0;
+    struct trace_event *e;
+
+    TracePrintf(0, "TRACE-RING: %u events, %u overwritten\n",
+        trace_next - i, i);
+
+    for (; i != trace_next; ++i) {
+        e = &trace_ring[i & (TRACE_EVENTS - 1)];
+        TracePrintf(0, "TRACE-EVENT: %x %x %d %x %x\n", e->time, e->event,
+            e->pid, e->arg0, e->arg1);
+    }
+#endif
+}
+
+/*
+ * Counts an entry into the kernel, and logs it if it is an interrupt.
+ *
+ * Each REPLAY line gives the vector, code, clock_count and the number
+ * of kernel entries so far, including this one. hostsim -r replays
+ * the interrupts at the same entry counts, which stand in for the
+ * instruction counts neither the kernel nor hostsim can read.
+ */
+void record_trap(ExceptionInfo *info) {
+    ++trap_count;
+
+#if REPLAY_LOG
+    switch (info->vector) {
+    case TRAP_CLOCK:
+    case TRAP_TTY_TRANSMIT:
+    case TRAP_TTY_RECEIVE:
+    case TRAP_DISK:
+        TracePrintf(0, "REPLAY: %d %d %u %u\n", info->vector, info->code,
+            clock_count, trap_count);
+    }
+#endif
+}
+
+/*
+ * Reports kernel statistics and halts the machine.
+ */
+void kernel_halt(void) {
+    unsigned int per_switch = switch_count == 0 ? 0 :
+        100 * switch_flushes / switch_count;
+
+    TracePrintf(0, "HALT: %u context switches, %u.%02u TLB flushes per "
+        "switch, %u TLB flushes in total\n", switch_count,
+        per_switch / 100, per_switch % 100, tlb_flushes);
+    TracePrintf(0, "HALT: %u zeroed pages taken ready, %u cleared on demand\n",
+        zeroed_hits, zeroed_misses);
+    TracePrintf(0, "HALT: %u pages swapped out, %u swapped in\n",
+        swap_outs, swap_ins);
+    print_syscall_stats();
+    trace_dump();
+
+    // A profile still running when the kernel halts is dumped as well
+    if (profiling)
+        profile_dump();
+
+    Halt();
+}
+
+/*
+ * Finds the pcb of the process with the given pid.
+ *
+ * Returns NULL if there is no such process.
+ */
+struct process_info *find_process(int pid) {
+    struct process_info *pcb;
+
+    if (pid < 0)
+        return NULL;
+
+    pcb = pid_table[pid % PID_TABLE_SIZE];
+    while (pcb != NULL && pcb->pid != pid)
+        pcb = pcb->pid_next;
+
+    return pcb;
+}
+
+/*
+ * Adds a new process to the pid table.
+ */
+void insert_pid(struct process_info *pcb) {
+    struct process_info **bucket = &pid_table[pcb->pid % PID_TABLE_SIZE];
+
+    pcb->pid_next = *bucket;
+    *bucket = pcb;
+}
+
+/*
+ * Removes an exiting process from the pid table.
+ */
+void remove_pid(struct process_info *pcb) {
+    struct process_info **p = &pid_table[pcb->pid % PID_TABLE_SIZE];
+
+    while (*p != NULL && *p != pcb)
+        p = &(*p)->pid_next;
+
+    if (*p != NULL)
+        *p = pcb->pid_next;
+}
+
 /*
  * Adds a single pcb to the provided queue.
  *
@@ -110,7 +663,11 @@ int free_page(int pfn) {
 void push_process(struct process_info **head, struct process_info **tail,
     struct process_info *new_pcb) {
 
-    TracePrintf(2, "PUSH PROCESS: Pushing process %d onto a queue\n", new_pcb->pid);
+    TRACE_EVENT(TRACE_ENQUEUE, new_pcb->pid, 0);
+
+    // Time on the ready queue is charged when the process leaves it
+    if (head == &process_queue)
+        new_pcb->ready_since = clock_count;
 
     if (*head == NULL) {
         *head = new_pcb;
@@ -146,6 +703,9 @@ struct process_info *pop_process(struct process_info **head,
     if (new_head != NULL) {
         *head = new_head->next_process;
         new_head->next_process = NULL;
+
+        if (head == &process_queue)
+            new_head->ticks_ready += clock_count - new_head->ready_since;
     }
 
     if (*head != NULL)
@@ -180,6 +740,9 @@ void remove_process(struct process_info **head, struct process_info **tail,
     pi->prev_process = NULL;
     pi->next_process = NULL;
 
+    if (head == &process_queue)
+        pi->ticks_ready += clock_count - pi->ready_since;
+
     TracePrintf(2, "Removing process %d from queue\n", pi->pid);
 
 }
@@ -27,6 +27,7 @@ void KernelStart(ExceptionInfo *info, unsigned int pmem_size,
     interrupt_table[TRAP_MATH] = &trap_math_handler;
     interrupt_table[TRAP_TTY_TRANSMIT] = &trap_tty_transmit_handler;
     interrupt_table[TRAP_TTY_RECEIVE] = &trap_tty_receive_handler;
+    interrupt_table[TRAP_DISK] = &trap_disk_handler;
 
     // Write address of interrupt vector table to REG_VECTOR_BASE register
     WriteRegister(REG_VECTOR_BASE, (RCS421RegVal) &interrupt_table);
@@ -46,9 +47,23 @@ void KernelStart(ExceptionInfo *info, unsigned int pmem_size,
     free_pages = (struct free_page *)
         malloc(sizeof(struct free_page) * tot_pmem_pages);
 
-    // Initial Region 0 (idle) Page Table, always at the top of VMEM
-    struct pte *idle_page_table = (struct pte *)(VMEM_LIMIT - PAGESIZE); 
-    struct pte *init_page_table = (struct pte *)(VMEM_LIMIT - 2 * PAGESIZE);
+    // Size the page table window for as many processes as there are
+    // frames for kernel stacks, leaving at least half of the rest of
+    // region 1 to the kernel heap
+    pt_window_pages = (tot_pmem_pages / KERNEL_STACK_PAGES
+        + TABLES_PER_PAGE - 1) / TABLES_PER_PAGE;
+    if (pt_window_pages > PT_WINDOW_MAX_PAGES)
+        pt_window_pages = PT_WINDOW_MAX_PAGES;
+    if (pt_window_pages > ((VMEM_1_LIMIT - UP_TO_PAGE(cur_brk)) / PAGESIZE
+        - NUM_COPY_SLOTS) / 2)
+        pt_window_pages = ((VMEM_1_LIMIT - UP_TO_PAGE(cur_brk)) / PAGESIZE
+            - NUM_COPY_SLOTS) / 2;
+    TracePrintf(0, "page table window: %d pages\n", pt_window_pages);
+
+    // Initial Region 0 (idle) Page Table, always at the top of VMEM,
+    // in the first two tables of the page table window
+    struct pte *idle_page_table = PT_WINDOW_TABLE(0);
+    struct pte *init_page_table = PT_WINDOW_TABLE(1);
 
     // Mark Physical Pages used by heap as used
     for (i = VMEM_1_BASE / PAGESIZE; i < (long)cur_brk / PAGESIZE; ++i) {
@@ -56,13 +71,11 @@ void KernelStart(ExceptionInfo *info, unsigned int pmem_size,
         ++allocated_pages;
     }
 
-    // Mark physical page used by idle_page_table
-    (free_pages + VMEM_LIMIT / PAGESIZE -  1)->in_use = 1;
-    ++allocated_pages;
-
-    //Mark physical page used by init page table
-    (free_pages + VMEM_LIMIT / PAGESIZE - 2)->in_use = 1;
-    ++allocated_pages;
+    // Mark physical pages used by the idle and init page tables
+    for (i = 0; i <= 1 / TABLES_PER_PAGE; ++i) {
+        (free_pages + VMEM_LIMIT / PAGESIZE - 1 - i)->in_use = 1;
+        ++allocated_pages;
+    }
 
     TracePrintf(0, "writing kernel ptes\n");
     // Initialize kernel page table
@@ -108,25 +121,19 @@ void KernelStart(ExceptionInfo *info, unsigned int pmem_size,
         kernel_page_table[i] = entry;
     }
 
-    //special entry for region 0 page table
-    struct pte idle_PT_entry = {
-        .pfn = (VMEM_LIMIT - PAGESIZE) >> PAGESHIFT,
-        .unused = 0b00000,
-        .uprot = PROT_NONE,
-        .kprot = PROT_READ | PROT_WRITE,
-        .valid = 0b1
-    };
-    kernel_page_table[PAGE_TABLE_LEN - 1] = idle_PT_entry;
-    
-    //special entry for init region 0 
-    struct pte init_PT_entry = {
-        .pfn = (VMEM_LIMIT - 2 * PAGESIZE) >> PAGESHIFT,
-        .unused = 0b00000,
-        .uprot = PROT_NONE,
-        .kprot = PROT_READ | PROT_WRITE,
-        .valid = 0b1
-    };
-    kernel_page_table[PAGE_TABLE_LEN - 2] = init_PT_entry;
+    //special entries for the idle and init region 0 page tables
+    for (i = 0; i <= 1 / TABLES_PER_PAGE; ++i) {
+        struct pte PT_entry = {
+            .pfn = (VMEM_LIMIT - (i + 1) * PAGESIZE) >> PAGESHIFT,
+            .unused = 0b00000,
+            .uprot = PROT_NONE,
+            .kprot = PROT_READ | PROT_WRITE,
+            .valid = 0b1
+        };
+        kernel_page_table[PT_WINDOW_INDEX(i)] = PT_entry;
+    }
+    pt_window_used[0] = 1;
+    pt_window_used[1] = 1;
 
 
     // Initialize Region 0
@@ -153,6 +160,7 @@ void KernelStart(ExceptionInfo *info, unsigned int pmem_size,
 
     TracePrintf(0, "pointer registers to initial r0 and r1 PT\n");
     WriteRegister(REG_PTR0, (RCS421RegVal) idle_page_table);
+    loaded_page_table = idle_page_table;
     WriteRegister(REG_PTR1, (RCS421RegVal) &kernel_page_table);
 
     // Setup idle process
@@ -163,7 +171,9 @@ void KernelStart(ExceptionInfo *info, unsigned int pmem_size,
         .pid = next_pid++,
         .user_pages = 0,
         .user_brk = (void *)MEM_INVALID_SIZE,
+        .stack_base = (void *)USER_STACK_LIMIT,
         .page_table = (void *)idle_page_table,
+        .pt_vaddr = idle_page_table,
         .parent = NO_PARENT,
         .next_process = NULL,
         .active_children = 0,
@@ -186,6 +196,9 @@ void KernelStart(ExceptionInfo *info, unsigned int pmem_size,
     WriteRegister(REG_VM_ENABLE, 1);
     vmem_enabled = 1;
 
+    // Set up the zero frame before any program is loaded
+    zero_pfn = alloc_zeroed_page();
+
     active_process = idle;
     LoadProgram("idle", NULL, info);
 
@@ -195,7 +208,9 @@ void KernelStart(ExceptionInfo *info, unsigned int pmem_size,
         .pid = next_pid++,
         .user_pages = 0,
         .user_brk = (void *)MEM_INVALID_SIZE,
-        .page_table = (void *)(VMEM_LIMIT - 2 * PAGESIZE),
+        .stack_base = (void *)USER_STACK_LIMIT,
+        .page_table = (void *)init_page_table,
+        .pt_vaddr = init_page_table,
         .delay_ticks = 0,
         .parent = NO_PARENT,
         .active_children = 0,
@@ -213,6 +228,10 @@ void KernelStart(ExceptionInfo *info, unsigned int pmem_size,
     };
     all_processes->next = init_process;
 
+    insert_pid(idle);
+    insert_pid(init);
+    live_processes = 1;
+
     // Get current context for init process
     ContextSwitch(ContextSwitchInitHelper, (SavedContext *)&idle->ctx,
         init, NULL);
@@ -242,7 +261,7 @@ int SetKernelBrk(void *addr) {
         //else allocate more physical pages
         else {
 
-            if (addr >= VMEM_1_LIMIT - NUM_RESERVED_KERNEL_PAGES * PAGESIZE)
+            if ((long)addr >= VMEM_1_LIMIT - NUM_RESERVED_KERNEL_PAGES * PAGESIZE)
                 return -1;
 
             // TODO: handle decreasing heap size